@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dat.h"
+
+// The analysis database: the results of the analysis, saved so the next run
+// can map them in instead of analysing again.  It is keyed by hashes of the
+// files the analysis read.  When the labels file alone has changed, the
+// analysis still stands and only what is formatted with labels is redone.
+//
+// The file is a header followed by arrays, each starting on an 8 byte
+// boundary.  It is written and read in this machine's byte order and
+// struct layout; a file from anywhere else fails the header checks and is
+// simply rebuilt.
+
+#define ADBMAGIC "dism68k adb\n"
+#define ADBVERSION 1
+
+enum {
+	ABLOCKS = 0,
+	AFIRST, AADDRS, AENDS, ALINENOS, APAGE, ALINEPAGE, // LineIndex
+	ABYFROM, ABYTO, // Xrefs
+	NARRAYS
+};
+
+typedef struct {
+	char magic[16];
+	uint32_t version;
+	uint32_t blocksize, xrefsize; // sizeof, as a check on the layout
+	uint64_t hash[NADBINPUTS];
+	int32_t nblocks, nlines, pagelo, pageshift, npages, lineshift, nlinepages, nxrefs;
+	uint64_t off[NARRAYS], len[NARRAYS]; // in bytes
+} AdbHeader;
+
+// 64-bit FNV-1a of the file's contents; 0 if it cannot be read.
+uint64_t hashfile(char *name) {
+	FILE *fp = fopen(name, "r");
+	if (fp == NULL) return 0;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for(size_t i = 0; i < n; i++) {
+			h ^= buf[i];
+			h *= 0x100000001b3ULL;
+		}
+	}
+	fclose(fp);
+	return h;
+}
+
+static void *array(Adb *db, AdbHeader *h, int which, size_t size, long n) {
+	if (h->len[which] != size * n || h->off[which] % 8 != 0 ||
+	    h->off[which] > db->len || h->len[which] > db->len - h->off[which])
+		return NULL;
+	return (char *)db->map + h->off[which];
+}
+
+/*
+	Does the index hold together, so that lookups in it stay inside its
+	arrays and the blocks inside bin?  A file can pass the hashes and still
+	be cut short or corrupt.
+*/
+static int validindex(Adb *db, Buffer *bin) {
+	LineIndex *li = &db->lines;
+	int lo = bin->len > 0 ? bin->sections[0]._baseaddress : 0;
+	int hi = bufferEndAddress(bin);
+	if (li->first[0] != 0) return 0;
+	for(int i = 0; i < db->nblocks; i++) {
+		BasicBlock *b = &db->blocks[i];
+		// A data block filling the gap after code that ran past a leader
+		// ends before it begins; only code blocks must run forwards.
+		if (b->begin < lo || b->begin > hi || b->end < lo || b->end > hi) return 0;
+		if (!b->isdata && b->begin > b->end) return 0;
+		if (li->first[i+1] - li->first[i] != (b->isdata ? 0 : b->ninstr)) return 0;
+	}
+	for(int p = 0; p <= li->npages; p++) {
+		if (li->page[p] < 0 || li->page[p] > db->nblocks) return 0;
+	}
+	for(int p = 0; p <= li->nlinepages; p++) {
+		if (li->linepage[p] < 0 || li->linepage[p] > db->nblocks) return 0;
+	}
+	return 1;
+}
+
+/*
+	Maps the database in, if it was made from files with these hashes and
+	fits bin; otherwise returns NULL.  A database made with other labels is
+	still returned, with *labelsok clear.
+*/
+Adb *openAdb(char *name, Buffer *bin, uint64_t *hash, int *labelsok) {
+	int fd = open(name, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(AdbHeader)) {
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	Adb *db = calloc(1, sizeof(Adb));
+	db->map = map;
+	db->len = st.st_size;
+	AdbHeader *h = map;
+	if (memcmp(h->magic, ADBMAGIC, sizeof(ADBMAGIC)) != 0 || h->version != ADBVERSION ||
+	    h->blocksize != sizeof(BasicBlock) || h->xrefsize != sizeof(Xref))
+		goto stale;
+	for(int i = 0; i < NADBINPUTS; i++) {
+		if (i != ADBLABELS && h->hash[i] != hash[i])
+			goto stale;
+	}
+	*labelsok = h->hash[ADBLABELS] == hash[ADBLABELS];
+	if (h->nblocks < 0 || h->nlines < 0 || h->npages < 0 || h->nlinepages < 0 || h->nxrefs < 0 ||
+	    h->pageshift < 0 || h->pageshift > 30 || h->lineshift < 0 || h->lineshift > 30)
+		goto stale;
+
+	int nb = h->nblocks;
+	LineIndex *li = &db->lines;
+	db->blocks = array(db, h, ABLOCKS, sizeof(BasicBlock), nb);
+	db->nblocks = nb;
+	li->blocks = db->blocks;
+	li->nblocks = nb;
+	li->first = array(db, h, AFIRST, sizeof(int), nb + 1);
+	li->addrs = li->first ? array(db, h, AADDRS, sizeof(int), li->first[nb]) : NULL;
+	li->ends = array(db, h, AENDS, sizeof(int), nb);
+	li->linenos = array(db, h, ALINENOS, sizeof(int), nb);
+	li->page = array(db, h, APAGE, sizeof(int), h->npages + 1);
+	li->linepage = array(db, h, ALINEPAGE, sizeof(int), h->nlinepages + 1);
+	li->nlines = h->nlines;
+	li->pagelo = h->pagelo;
+	li->pageshift = h->pageshift;
+	li->npages = h->npages;
+	li->lineshift = h->lineshift;
+	li->nlinepages = h->nlinepages;
+	li->shared = 1;
+	Xrefs *x = &db->xrefs;
+	x->byfrom = array(db, h, ABYFROM, sizeof(Xref), h->nxrefs);
+	x->byto = array(db, h, ABYTO, sizeof(Xref), h->nxrefs);
+	x->len = h->nxrefs;
+	x->shared = 1;
+	if (!db->blocks || !li->first || !li->addrs || !li->ends || !li->linenos || !li->page ||
+	    !li->linepage || !x->byfrom || !x->byto || !validindex(db, bin))
+		goto stale;
+	return db;
+
+stale:
+	munmap(map, st.st_size);
+	free(db);
+	return NULL;
+}
+
+void closeAdb(Adb *db) {
+	munmap(db->map, db->len);
+	free(db);
+}
+
+static int put(FILE *fp, AdbHeader *h, int which, void *p, size_t len) {
+	long off = ftell(fp);
+	static const char zeros[8];
+	if (off % 8 != 0 && fwrite(zeros, 1, 8 - off % 8, fp) != (size_t)(8 - off % 8))
+		return -1;
+	h->off[which] = ftell(fp);
+	h->len[which] = len;
+	return len == 0 || fwrite(p, len, 1, fp) == 1 ? 0 : -1;
+}
+
+/*
+	Saves the analysis under name, made from files with these hashes.
+	Writes a new file and renames it over the old, so a database that is
+	mapped in stays intact.  Returns 0, or -1 with errno set.
+*/
+int saveAdb(char *name, uint64_t *hash, BasicBlock *blocks, int nblocks, LineIndex *li, Xrefs *x) {
+	char *tmp = malloc(strlen(name) + sizeof(".tmp"));
+	sprintf(tmp, "%s.tmp", name);
+	FILE *fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		free(tmp);
+		return -1;
+	}
+	AdbHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ADBMAGIC, sizeof(ADBMAGIC));
+	h.version = ADBVERSION;
+	h.blocksize = sizeof(BasicBlock);
+	h.xrefsize = sizeof(Xref);
+	memcpy(h.hash, hash, sizeof(h.hash));
+	h.nblocks = nblocks;
+	h.nlines = li->nlines;
+	h.pagelo = li->pagelo;
+	h.pageshift = li->pageshift;
+	h.npages = li->npages;
+	h.lineshift = li->lineshift;
+	h.nlinepages = li->nlinepages;
+	h.nxrefs = x->len;
+
+	int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+		put(fp, &h, ABLOCKS, blocks, sizeof(BasicBlock) * nblocks) == 0 &&
+		put(fp, &h, AFIRST, li->first, sizeof(int) * (nblocks + 1)) == 0 &&
+		put(fp, &h, AADDRS, li->addrs, sizeof(int) * li->first[nblocks]) == 0 &&
+		put(fp, &h, AENDS, li->ends, sizeof(int) * nblocks) == 0 &&
+		put(fp, &h, ALINENOS, li->linenos, sizeof(int) * nblocks) == 0 &&
+		put(fp, &h, APAGE, li->page, sizeof(int) * (li->npages + 1)) == 0 &&
+		put(fp, &h, ALINEPAGE, li->linepage, sizeof(int) * (li->nlinepages + 1)) == 0 &&
+		put(fp, &h, ABYFROM, x->byfrom, sizeof(Xref) * x->len) == 0 &&
+		put(fp, &h, ABYTO, x->byto, sizeof(Xref) * x->len) == 0 &&
+		fseek(fp, 0, SEEK_SET) == 0 &&
+		fwrite(&h, sizeof(h), 1, fp) == 1;
+	if (fclose(fp) != 0) ok = 0;
+	if (ok && rename(tmp, name) != 0) ok = 0;
+	int e = errno;
+	if (!ok) unlink(tmp);
+	free(tmp);
+	errno = e;
+	return ok ? 0 : -1;
+}
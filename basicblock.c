@@ -12,11 +12,17 @@ The function signature should be 'findDataRegions(int *basicblocks,  int **retpa
 Avoid using any external libraries.  If you need help with instruction decoding, ask for help. Do not explain your work. If you find the task too difficult, pause and ask me for help. If you need clarification, pause and ask for help.
 */
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
 #include "dat.h"
 
+#define PAGESHIFT 8 // Smallest page of the LineIndex address map
+
 // returns offset of basic block.
 int findAddr(int addr, BasicBlock *blocks, int nblocks) {
 	int l, r, m;
@@ -34,9 +40,10 @@ int findAddr(int addr, BasicBlock *blocks, int nblocks) {
 	return l;
 }
 
-int countlines_n;
-void count(char *s, int addr, void*d) {
-	countlines_n ++;
+// The lines datadump() prints for [begin, end): one per 16 byte row touched.
+int datalines(int begin, int end) {
+	int rows = (((end + 0xf) & ~0xf) - (begin & ~0xf)) / 16;
+	return rows > 0 ? rows : 0;
 }
 
 // Counts lines and fixes up nlines.
@@ -45,227 +52,745 @@ int countlines(Buffer *bin, BasicBlock *blocks, int nblocks) {
 	for(int i=0; i < nblocks; i++) {
 		blocks[i].lineno = lineno;
 		if (blocks[i].isdata) {
-			countlines_n = 0;
-			datadump(bin, blocks[i].begin, blocks[i].end, count, NULL, -1);
-			lineno += countlines_n;
-			blocks[i].nlines = countlines_n;
+			int n = datalines(blocks[i].begin, blocks[i].end);
+			lineno += n;
+			blocks[i].nlines = n;
 		}
 		else lineno += blocks[i].ninstr;
 	}
 	return lineno;
 }
 
-void findBasicBlocks(Buffer *bin, int *leaders, int nleaders, BasicBlock **outblocks, int *nblocks, int **invalid, int *ninvalid) {
-	BasicBlock *blocks = NULL;
-	int blockCount = 0;
-	int blockCapacity = 0;
-	
-	int *invalidAddrs = NULL;
-	int invalidCount = 0;
-	int invalidCapacity = 0;
+// One bit per byte of each section, so unmapped space takes no room.
+typedef struct {
+	Buffer *bin;
+	uint32_t **bits;
+} ByteSet;
 
-	int endAddr = bufferEndAddress(bin);
-	
-	// Track which addresses are block leaders
-	bool *isLeader = (bool*)calloc(endAddr, sizeof(bool));
-	if (!isLeader) return;
-	
-	// Track visited addresses to avoid infinite loops
-	bool *visited = (bool*)calloc(endAddr, sizeof(bool));
-	if (!visited) {
-		free(isLeader);
-		return;
+static ByteSet newByteSet(Buffer *bin) {
+	ByteSet s = {bin, calloc(bin->len, sizeof(uint32_t *))};
+	for(int i = 0; i < bin->len; i++)
+		s.bits[i] = calloc(bin->sections[i]._len / 32 + 1, sizeof(uint32_t));
+	return s;
+}
+
+static void freeByteSet(ByteSet *s) {
+	for(int i = 0; i < s->bin->len; i++)
+		free(s->bits[i]);
+	free(s->bits);
+}
+
+// The word holding addr's bit, or NULL if addr is not mapped.
+static uint32_t *bytesetword(ByteSet *s, int addr, uint32_t *mask) {
+	int sec = bufferSectionByAddr(s->bin, addr);
+	if (sec < 0) return NULL;
+	int off = addr - s->bin->sections[sec]._baseaddress;
+	*mask = 1u << (off & 31);
+	return &s->bits[sec][off >> 5];
+}
+
+// The bit operations are atomic, so explorers can share a set.
+static bool inset(ByteSet *s, int addr) {
+	uint32_t mask, *w = bytesetword(s, addr, &mask);
+	return w != NULL && (__atomic_load_n(w, __ATOMIC_RELAXED) & mask);
+}
+
+// Sets addr's bit; returns whether it was already set.  Unmapped addresses count as set.
+static bool addset(ByteSet *s, int addr) {
+	uint32_t mask, *w = bytesetword(s, addr, &mask);
+	return w == NULL || (__atomic_fetch_or(w, mask, __ATOMIC_RELAXED) & mask);
+}
+
+// What the first pass learned about each instruction, a byte per mapped
+// byte: its length, and whether it ends a block.  0 for an invalid instruction.
+#define STEPLEN 0x0f
+#define STEPEND 0x10
+
+typedef struct {
+	Buffer *bin;
+	uint8_t **steps;
+} Steps;
+
+static Steps newSteps(Buffer *bin) {
+	Steps s = {bin, calloc(bin->len, sizeof(uint8_t *))};
+	for(int i = 0; i < bin->len; i++)
+		s.steps[i] = calloc(bin->sections[i]._len, 1);
+	return s;
+}
+
+static void freeSteps(Steps *s) {
+	for(int i = 0; i < s->bin->len; i++)
+		free(s->steps[i]);
+	free(s->steps);
+}
+
+// The step for addr, which must be mapped.
+static uint8_t *stepat(Steps *s, int addr) {
+	int sec = bufferSectionByAddr(s->bin, addr);
+	return &s->steps[sec][addr - s->bin->sections[sec]._baseaddress];
+}
+
+// Appends a block, first filling any gap since the last one with a data block.
+static void appendblock(BasicBlock **blocks, int *n, int *cap, BasicBlock b) {
+	if (*n + 2 > *cap) {
+		*cap = *cap ? *cap * 2 : 32;
+		*blocks = realloc(*blocks, sizeof(BasicBlock) * *cap);
+		assert(*blocks);
 	}
-	
-	// Stack for addresses to process
-	int *stack = (int*)malloc(endAddr * sizeof(int));
-	if (!stack) {
-		free(isLeader);
-		free(visited);
-		return;
+	if (*n > 0 && (*blocks)[*n-1].end != b.begin) {
+		(*blocks)[*n] = (*blocks)[*n-1];
+		(*blocks)[*n].begin = (*blocks)[*n-1].end;
+		(*blocks)[*n].end = b.begin;
+		(*blocks)[*n].ninstr = 0; // we will present at most 16 bytes per line
+		(*blocks)[*n].nlines = 1;
+		(*blocks)[*n].isdata = true;
+		(*n)++;
 	}
-	int stackTop = 0;
-	
-	if (leaders == NULL)  {
-		// Start at address 0
-		isLeader[0] = true;
-		stack[stackTop++] = 0;
-	} else {
-		for(int i = 0; i < nleaders; i++) {
-			isLeader[leaders[i]] = true;
-			stack[stackTop++] = leaders[i];
+	(*blocks)[(*n)++] = b;
+}
+
+/*
+	First pass state.  Each explorer owns a deque of addresses still to
+	explore: it pushes and pops at the back, so one explorer walks depth
+	first as a plain stack would, and idle explorers steal from the front
+	of the others'.  Whoever sets an address's visited bit explores it, so
+	the sets found don't depend on the order.
+*/
+typedef struct {
+	int *addrs; // live entries are addrs[head..tail)
+	int head, tail, cap;
+	pthread_mutex_t lock;
+} Deque;
+
+typedef struct {
+	Cfg *cfg;
+	Deque *deques;
+	int ndeques;
+	long pending; // addresses pushed but not yet explored
+	pthread_mutex_t lock; // for cfg->invalid
+} Explorer;
+
+typedef struct {
+	Explorer *x;
+	int id;
+} ExploreArg;
+
+// A range of addresses marked as data, or a leader, to be undone.
+typedef struct {
+	int isdata;
+	int begin, end;
+} Edit;
+
+/*
+	The analysis, kept so that it can be edited: the leaders it starts
+	from, the ranges marked as data, what the first pass learned, and the
+	blocks built from that.
+*/
+struct Cfg {
+	Buffer *bin;
+	int nthreads;
+	int *roots;
+	int nroots, caproots;
+	Edit *data; // ranges marked as data
+	int ndata, capdata;
+	ByteSet isLeader, visited, isdata;
+	Steps steps;
+	BasicBlock *blocks;
+	int nblocks, capblocks;
+	int *invalid;
+	int ninvalid, capinvalid;
+	Edit *undo;
+	int nundo, capundo;
+};
+
+static void push(Explorer *x, int id, int addr) {
+	Deque *d = &x->deques[id];
+	__atomic_add_fetch(&x->pending, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&d->lock);
+	if (d->tail == d->cap) {
+		if (d->head > 0) {
+			memmove(d->addrs, d->addrs + d->head, sizeof(int) * (d->tail - d->head));
+			d->tail -= d->head;
+			d->head = 0;
+		} else {
+			d->cap = d->cap ? d->cap * 2 : 256;
+			d->addrs = realloc(d->addrs, sizeof(int) * d->cap);
+		}
+	}
+	d->addrs[d->tail++] = addr;
+	pthread_mutex_unlock(&d->lock);
+}
+
+static bool pop(Explorer *x, int id, int *addr) {
+	Deque *d = &x->deques[id];
+	pthread_mutex_lock(&d->lock);
+	bool ok = d->tail > d->head;
+	if (ok) *addr = d->addrs[--d->tail];
+	pthread_mutex_unlock(&d->lock);
+	return ok;
+}
+
+static bool steal(Explorer *x, int id, int *addr) {
+	for(int i = 1; i < x->ndeques; i++) {
+		Deque *d = &x->deques[(id + i) % x->ndeques];
+		pthread_mutex_lock(&d->lock);
+		bool ok = d->tail > d->head;
+		if (ok) *addr = d->addrs[d->head++];
+		pthread_mutex_unlock(&d->lock);
+		if (ok) return true;
+	}
+	return false;
+}
+
+// Decodes the instruction at addr, if nobody has, and queues its successors.
+static void explore(Explorer *x, int id, int addr) {
+	Cfg *c = x->cfg;
+	if (inset(&c->isdata, addr) || addset(&c->visited, addr)) return;
+	Flow inst;
+	if (!decodeflow(c->bin, addr, &inst)) {
+		// Invalid instruction
+		pthread_mutex_lock(&x->lock);
+		if (c->ninvalid >= c->capinvalid) {
+			c->capinvalid = c->capinvalid ? c->capinvalid * 2 : 16;
+			c->invalid = realloc(c->invalid, sizeof(int) * c->capinvalid);
 		}
+		c->invalid[c->ninvalid++] = addr;
+		pthread_mutex_unlock(&x->lock);
+		return;
 	}
 	
-	// First pass: find all reachable code and mark leaders
-	while (stackTop > 0) {
-		int addr = stack[--stackTop];
-if (addr > 0x00f00000) {
-	assert(addr > 0x00f00000);
-}
-		if (addr >= endAddr || visited[addr]) continue;
-		Labels labels = {.len = 0};
-		struct Instruction inst;
-		if (!disasmone(bin, addr, &inst, &labels)) {
-			// Invalid instruction
-			if (invalidCount >= invalidCapacity) {
-				invalidCapacity = invalidCapacity ? invalidCapacity * 2 : 16;
-				invalidAddrs = realloc(invalidAddrs, sizeof(int) * invalidCapacity);
-				if (!invalidAddrs) break;
+	*stepat(&c->steps, addr) = inst.nbytes | (inst.isBranch || inst.isJump || inst.isRet ? STEPEND : 0);
+	int nextAddr = addr + inst.nbytes;
+	
+	if (inst.isBranch || inst.isJump) {
+		// Target of branch is a leader
+		if (bufferIsMappedAddress(c->bin, inst.targetAddress)) {
+			addset(&c->isLeader, inst.targetAddress);
+			if (!inset(&c->visited, inst.targetAddress)) {
+				push(x, id, inst.targetAddress);
 			}
-			invalidAddrs[invalidCount++] = addr;
-			visited[addr] = true;
-			continue;
 		}
-		
-		visited[addr] = true;
-		int nextAddr = addr + inst.nbytes;
-		
-		if (inst.isBranch || inst.isJump) {
-			// Target of branch is a leader
-			if (inst.targetAddress < endAddr) {
-				isLeader[inst.targetAddress] = true;
-				if (!visited[inst.targetAddress]) {
-					stack[stackTop++] = inst.targetAddress;
-				}
-			}
 
-			// Instruction after branch is a leader (for conditional branches, not for subroutine returns)
-			if (inst.isBranch && (nextAddr < endAddr)) {
-				isLeader[nextAddr] = true;
-				if (!visited[nextAddr]) {
-					stack[stackTop++] = nextAddr;
-				}
+		// Instruction after branch is a leader (for conditional branches, not for subroutine returns)
+		if (inst.isBranch && bufferIsMappedAddress(c->bin, nextAddr)) {
+			addset(&c->isLeader, nextAddr);
+			if (!inset(&c->visited, nextAddr)) {
+				push(x, id, nextAddr);
 			}
-		} else if (inst.isRet) {
-			// Don't follow after return
-		} else {
-			// Continue to next instruction
-			if (nextAddr < endAddr) {
-				if (!visited[nextAddr]) {
-					stack[stackTop++] = nextAddr;
-				}
+		}
+	} else if (inst.isRet) {
+		// Don't follow after return
+	} else {
+		// Continue to next instruction
+		if (bufferIsMappedAddress(c->bin, nextAddr)) {
+			if (!inset(&c->visited, nextAddr)) {
+				push(x, id, nextAddr);
 			}
 		}
 	}
-	
-	// Second pass: build basic blocks
-	for (int addr = 0; addr < endAddr; addr++) {
-		if (!isLeader[addr] || !visited[addr]) continue;
-		
-		int blockStart = addr;
-		int currentAddr = addr;
-		int ninstr = 0;
-
-		// Find end of basic block
-		while (currentAddr < endAddr && visited[currentAddr]) {
-			struct Instruction inst;
-			Labels labels = {.len = 0};
-			if (!disasmone(bin, currentAddr, &inst, &labels)) {
-				break;
-			}
-			
-			ninstr++;
-			int nextAddr = currentAddr + inst.nbytes;
-			
-			// Block ends if:
-			// 1. Next instruction is a leader
-			// 2. This is a branch or return
-			// 3. We reach end of binary
-			if (nextAddr >= endAddr || 
-				(nextAddr < endAddr && isLeader[nextAddr]) ||
-				inst.isBranch || inst.isJump || inst.isRet) {
-				
-				// Add block
-				if (blockCount >= blockCapacity) {
-					blockCapacity = blockCapacity ? blockCapacity * 2 : 32;
-					blocks = realloc(blocks, sizeof(BasicBlock) * blockCapacity);
-					if (!blocks) break;
-				}
-				
-				blocks[blockCount].begin = blockStart;
-				blocks[blockCount].end = currentAddr + inst.nbytes;
-				blocks[blockCount].ninstr = ninstr;
-				blocks[blockCount].lineno = -1;
-				blocks[blockCount].isdata = 0;
-				blockCount++;
-				break;
-			}
-			
-			currentAddr = nextAddr;
+}
+
+static void *explorer(void *arg) {
+	Explorer *x = ((ExploreArg *)arg)->x;
+	int id = ((ExploreArg *)arg)->id;
+	for(;;) {
+		int addr;
+		if (pop(x, id, &addr) || steal(x, id, &addr)) {
+			explore(x, id, addr);
+			__atomic_sub_fetch(&x->pending, 1, __ATOMIC_ACQ_REL);
+		} else if (__atomic_load_n(&x->pending, __ATOMIC_ACQUIRE) == 0) {
+			break;
+		} else {
+			sched_yield(); // Someone is still exploring, and may push more.
 		}
 	}
-	
-	// Sort blocks by start address
+	return NULL;
+}
+
+static int intcmp(const void *a, const void *b) {
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
 
-	int len = blockCount;
-	for (int i = 1; i < len; i ++) {
-		BasicBlock b = blocks[i];
-		int startAddr = b.begin;
-		int j = i - 1;
+// First pass: finds all code reachable from the leaders and marks leaders, adding to what is known.
+static void explorefrom(Cfg *c, int *leaders, int nleaders) {
+	int nthreads = c->nthreads;
+	Explorer x = {
+		.cfg = c,
+		.deques = calloc(nthreads, sizeof(Deque)),
+		.ndeques = nthreads,
+	};
+	pthread_mutex_init(&x.lock, NULL);
+	for(int t = 0; t < nthreads; t++)
+		pthread_mutex_init(&x.deques[t].lock, NULL);
+
+	// Dealt round, so every explorer starts with work.
+	for(int i = 0; i < nleaders; i++) {
+		addset(&c->isLeader, leaders[i]);
+		push(&x, i % nthreads, leaders[i]);
+	}
+
+	ExploreArg *args = malloc(sizeof(ExploreArg) * nthreads);
+	pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+	for(int t = 0; t < nthreads; t++)
+		args[t] = (ExploreArg){&x, t};
+	for(int t = 1; t < nthreads; t++)
+		pthread_create(&threads[t], NULL, explorer, &args[t]);
+	explorer(&args[0]);
+	for(int t = 1; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	free(args);
+	qsort(c->invalid, c->ninvalid, sizeof(int), intcmp);
+
+	for(int t = 0; t < nthreads; t++) {
+		free(x.deques[t].addrs);
+		pthread_mutex_destroy(&x.deques[t].lock);
+	}
+	free(x.deques);
+	pthread_mutex_destroy(&x.lock);
+}
+
+// Forgets what the first pass found and runs it again from the leaders.
+static void reexplore(Cfg *c) {
+	for(int i = 0; i < c->bin->len; i++) {
+		size_t words = c->bin->sections[i]._len / 32 + 1;
+		memset(c->isLeader.bits[i], 0, words * sizeof(uint32_t));
+		memset(c->visited.bits[i], 0, words * sizeof(uint32_t));
+		memset(c->isdata.bits[i], 0, words * sizeof(uint32_t));
+	}
+	for(int i = 0; i < c->ndata; i++)
+		for(int a = c->data[i].begin; a < c->data[i].end; a++)
+			addset(&c->isdata, a);
+	c->ninvalid = 0;
+	explorefrom(c, c->roots, c->nroots);
+}
+
+// Appends the basic block that starts at the leader addr.
+static void assembleblock(Cfg *c, int addr, BasicBlock **blocks, int *blockCount, int *blockCapacity) {
+	int blockStart = addr;
+	int currentAddr = addr;
+	int ninstr = 0;
+
+	// Find end of basic block
+	while (inset(&c->visited, currentAddr)) {
+		uint8_t step = *stepat(&c->steps, currentAddr);
+		if (step == 0) {
+			break; // Invalid instruction
+		}
 		
-		while (j >= 0 && blocks[j].begin > startAddr) {
-			blocks[j + 1] = blocks[j];
-			j -= 1;
+		ninstr++;
+		int nextAddr = currentAddr + (step & STEPLEN);
+		
+		// Block ends if:
+		// 1. Next instruction is a leader, or marked as data
+		// 2. This is a branch or return
+		// 3. We reach the end of the section
+		if (!bufferIsMappedAddress(c->bin, nextAddr) || 
+			inset(&c->isLeader, nextAddr) ||
+			inset(&c->isdata, nextAddr) ||
+			(step & STEPEND)) {
+			appendblock(blocks, blockCount, blockCapacity, (BasicBlock){
+				.begin = blockStart,
+				.end = nextAddr,
+				.ninstr = ninstr,
+				.lineno = -1,
+				.isdata = 0,
+			});
+			break;
 		}
 		
-		blocks[j + 1] = b;
-	}
-
-	// Find data sections - they lie between basic blocks; we insert them.
-	for(int i = 1; i < blockCount; i++) {
-		if (blocks[i-1].end != blocks[i].begin) {
-			// Add block
-			blockCount++;
-			if (blockCount >= blockCapacity) {
-				blockCapacity = blockCapacity ? blockCapacity * 2 : 32;
-				blocks = realloc(blocks, sizeof(BasicBlock) * blockCapacity);
-				assert(blocks);
-			}
-			// Shift blocks up
-			for(int j = blockCount - 1; j >= i; j--) {
-				blocks[j] = blocks[j-1];
-			}
-			// Build the data block
-			blocks[i].begin = blocks[i].end;
-			blocks[i].end = blocks[i+1].begin;
-			blocks[i].ninstr = 0; //((blocks[i].end - blocks[i].begin)+7) % 8; // we will present at most 16 bytes per line; instrs count in pairs
-			blocks[i].nlines = 1;
-			blocks[i].isdata = true;
+		currentAddr = nextAddr;
+	}
+}
+
+// Second pass: appends the basic blocks with leaders in [lo, hi), in address
+// order, a word of leaders at a time, with the data between them.
+static void assemble(Cfg *c, int lo, int hi, BasicBlock **blocks, int *blockCount, int *blockCapacity) {
+	Buffer *bin = c->bin;
+	for (int sec = 0; sec < bin->len; sec++) {
+		int base = bin->sections[sec]._baseaddress;
+		int from = lo > base ? lo - base : 0;
+		int to = (long)hi < (long)base + (long)bin->sections[sec]._len ? hi - base : (int)bin->sections[sec]._len;
+		if (from >= to) continue;
+		for (int wi = from / 32; wi <= (to - 1) / 32; wi++) {
+			uint32_t bits = c->isLeader.bits[sec][wi] & c->visited.bits[sec][wi];
+			if (wi == from / 32) bits &= ~0u << (from % 32);
+			if (wi == (to - 1) / 32 && to % 32 != 0) bits &= (1u << (to % 32)) - 1;
+			for (; bits != 0; bits &= bits - 1)
+				assembleblock(c, base + wi * 32 + __builtin_ctz(bits), blocks, blockCount, blockCapacity);
 		}
 	}
-			
+}
+
+// Sets lineno from block from on.
+static void renumber(BasicBlock *blocks, int nblocks, int from) {
+	for(int i = from; i < nblocks; i++) {
+		if (i == 0) {
+			blocks[i].lineno = 0;
+			continue;
+		}
+		BasicBlock *p = &blocks[i-1];
+		blocks[i].lineno = p->lineno + (p->isdata ? p->nlines : p->ninstr);
+	}
+}
+
+static ByteSet copyByteSet(ByteSet *s) {
+	ByteSet t = newByteSet(s->bin);
+	for(int i = 0; i < s->bin->len; i++)
+		memcpy(t.bits[i], s->bits[i], (s->bin->sections[i]._len / 32 + 1) * sizeof(uint32_t));
+	return t;
+}
+
+// Widens [lo, hi) to cover every address whose bit differs between a and b.
+static void diffByteSet(ByteSet *a, ByteSet *b, int *lo, int *hi) {
+	for(int i = 0; i < a->bin->len; i++) {
+		int base = a->bin->sections[i]._baseaddress;
+		int words = a->bin->sections[i]._len / 32 + 1;
+		for(int w = 0; w < words; w++) {
+			if (a->bits[i][w] == b->bits[i][w]) continue;
+			if (base + w * 32 < *lo) *lo = base + w * 32;
+			if (base + w * 32 + 32 > *hi) *hi = base + w * 32 + 32;
+		}
+	}
+}
+
+/*
+	Rebuilds the blocks that may cover [lo, hi), which holds every address
+	whose analysis changed, and fixes up the line numbers and generated
+	labels to match.  The blocks either side keep their extent: the region
+	rebuilt starts after a code block and ends at one.
+*/
+static void rebuild(Cfg *c, int lo, int hi, Labels *labels) {
+	BasicBlock *old = c->blocks;
+	int n = c->nblocks;
+	int a = findAddr(lo, old, n);
+	if (a > 0) a--; // It may end at lo.
+	while (a > 0 && old[a-1].isdata) a--;
+	int b = findAddr(hi, old, n);
+	if (b < n) b++;
+	while (b < n && old[b].isdata) b++;
+	int from = a > 0 ? old[a].begin : INT_MIN;
+	int to = b < n ? old[b].begin : INT_MAX;
+
+	int cap = n + 32, nn = a;
+	BasicBlock *blocks = malloc(sizeof(BasicBlock) * cap);
+	memcpy(blocks, old, sizeof(BasicBlock) * a);
+	assemble(c, from, to, &blocks, &nn, &cap);
+	if (b < n) {
+		appendblock(&blocks, &nn, &cap, old[b]);
+		int rest = n - b - 1;
+		if (nn + rest > cap) {
+			cap = nn + rest;
+			blocks = realloc(blocks, sizeof(BasicBlock) * cap);
+		}
+		memcpy(&blocks[nn], &old[b+1], sizeof(BasicBlock) * rest);
+		nn += rest;
+	}
+	int a2 = b < n ? nn - (n - b) : nn; // old[b] is now blocks[a2]
+
+	countlines(c->bin, blocks + a, a2 - a);
+	renumber(blocks, nn, a);
+
+	if (labels != NULL) {
+		// Overlapping code makes data blocks run backwards, so begins are
+		// neither sorted nor unique: look them up in a sorted copy.
+		int *begins = malloc(sizeof(int) * (nn + 1));
+		for(int i = 0; i < nn; i++)
+			begins[i] = blocks[i].begin;
+		qsort(begins, nn, sizeof(int), intcmp);
+
+		// Block begins that are gone lose their generated labels; new ones get them.
+		for(int i = a; i < b; i++) {
+			int l = findLabelByAddr(labels, old[i].begin);
+			if (l != -1 && labels->labels[l].generated && !bsearch(&old[i].begin, begins, nn, sizeof(int), intcmp))
+				deleteLabel(labels, old[i].begin);
+		}
+		generateLabels(labels, blocks + a, a2 - a);
+		free(begins);
+	}
+
+	free(old);
+	c->blocks = blocks;
+	c->nblocks = nn;
+	c->capblocks = cap;
+}
+
+static void pushundo(Cfg *c, Edit e) {
+	if (c->nundo == c->capundo) {
+		c->capundo = c->capundo ? c->capundo * 2 : 16;
+		c->undo = realloc(c->undo, sizeof(Edit) * c->capundo);
+	}
+	c->undo[c->nundo++] = e;
+}
+
+/*
+	Analyses bin from leaders, or from 0 if leaders is NULL.  The first pass
+	explores on nthreads threads; 0 means one per processor.
+*/
+Cfg *newCfg(Buffer *bin, int *leaders, int nleaders, int nthreads) {
+	STATPHASE("findBasicBlocks");
+	Cfg *c = calloc(1, sizeof(Cfg));
+	c->bin = bin;
+	c->nthreads = nthreads > 0 ? nthreads : listingthreads();
+	if (leaders == NULL) {
+		// Start at address 0
+		static int zero = 0;
+		leaders = &zero;
+		nleaders = 1;
+	}
+	c->caproots = nleaders + 16;
+	c->roots = malloc(sizeof(int) * c->caproots);
+	memcpy(c->roots, leaders, sizeof(int) * nleaders);
+	c->nroots = nleaders;
+
+	// Only mapped addresses are explored.
+	c->isLeader = newByteSet(bin);
+	c->visited = newByteSet(bin);
+	c->isdata = newByteSet(bin);
+	c->steps = newSteps(bin);
+	explorefrom(c, c->roots, c->nroots);
+	assemble(c, INT_MIN, INT_MAX, &c->blocks, &c->nblocks, &c->capblocks);
 
 	// Count lines
+	STATPHASE("countlines");
+	countlines(bin, c->blocks, c->nblocks);
+	return c;
+}
+
+void freeCfg(Cfg *c) {
+	freeByteSet(&c->isLeader);
+	freeByteSet(&c->visited);
+	freeByteSet(&c->isdata);
+	freeSteps(&c->steps);
+	free(c->roots);
+	free(c->data);
+	free(c->blocks);
+	free(c->invalid);
+	free(c->undo);
+	free(c);
+}
+
+// The current blocks, in address order; they move on every edit.
+BasicBlock *cfgBlocks(Cfg *c, int *nblocks) {
+	*nblocks = c->nblocks;
+	return c->blocks;
+}
 
-	countlines(bin, blocks, blockCount);
-	// Clean up
-	free(isLeader);
-	free(visited);
-	free(stack);
+// Runs change, then rebuilds whatever it affected, and [lo, hi) besides.
+static void reanalyse(Cfg *c, void (*change)(Cfg *, void *), void *arg, int lo, int hi, Labels *labels) {
+	ByteSet visited = copyByteSet(&c->visited);
+	ByteSet isLeader = copyByteSet(&c->isLeader);
+	change(c, arg);
+	diffByteSet(&visited, &c->visited, &lo, &hi);
+	diffByteSet(&isLeader, &c->isLeader, &lo, &hi);
+	if (lo < hi) rebuild(c, lo, hi, labels);
+	freeByteSet(&visited);
+	freeByteSet(&isLeader);
+}
+
+static void exploreone(Cfg *c, void *arg) {
+	explorefrom(c, (int *)arg, 1);
+}
+
+static void exploreall(Cfg *c, void *arg) {
+	(void)arg;
+	reexplore(c);
+}
+
+// Starts code at addr, exploring only what becomes reachable.  Returns -1 if addr is not mapped.
+int cfgAddLeader(Cfg *c, int addr, Labels *labels) {
+	if (!bufferIsMappedAddress(c->bin, addr)) return -1;
+	if (c->nroots == c->caproots) {
+		c->caproots *= 2;
+		c->roots = realloc(c->roots, sizeof(int) * c->caproots);
+	}
+	c->roots[c->nroots++] = addr;
+	pushundo(c, (Edit){0, addr, addr});
+	reanalyse(c, exploreone, &addr, INT_MAX, INT_MIN, labels);
+	return 0;
+}
+
+/*
+	Marks [begin, end) as data: it is never explored, and code that was
+	reachable only through it goes back to data too.  This runs the first
+	pass again, which is quick; only the affected blocks are rebuilt.
+*/
+int cfgMarkData(Cfg *c, int begin, int end, Labels *labels) {
+	if (begin >= end) return -1;
+	if (c->ndata == c->capdata) {
+		c->capdata = c->capdata ? c->capdata * 2 : 16;
+		c->data = realloc(c->data, sizeof(Edit) * c->capdata);
+	}
+	c->data[c->ndata++] = (Edit){1, begin, end};
+	pushundo(c, (Edit){1, begin, end});
+	reanalyse(c, exploreall, NULL, begin, end, labels);
+	return 0;
+}
+
+// Undoes the last cfgAddLeader() or cfgMarkData().  Returns -1 if there is none.
+int cfgUndo(Cfg *c, Labels *labels) {
+	if (c->nundo == 0) return -1;
+	Edit e = c->undo[--c->nundo];
+	if (e.isdata) {
+		for(int i = c->ndata - 1; i >= 0; i--) {
+			if (c->data[i].begin == e.begin && c->data[i].end == e.end) {
+				memmove(&c->data[i], &c->data[i+1], sizeof(Edit) * (c->ndata - i - 1));
+				c->ndata--;
+				break;
+			}
+		}
+	} else {
+		for(int i = c->nroots - 1; i >= 0; i--) {
+			if (c->roots[i] == e.begin) {
+				memmove(&c->roots[i], &c->roots[i+1], sizeof(int) * (c->nroots - i - 1));
+				c->nroots--;
+				break;
+			}
+		}
+	}
+	reanalyse(c, exploreall, NULL, e.begin, e.end > e.begin ? e.end : e.begin + 1, labels);
+	return 0;
+}
+
+/*
+	Finds the basic blocks reachable from leaders, or from 0 if leaders is
+	NULL, with the data blocks between them, in address order.  The first
+	pass explores on nthreads threads; 0 means one per processor.  invalid
+	gets the addresses of undecodable instructions met, sorted.
+*/
+void findBasicBlocks(Buffer *bin, int *leaders, int nleaders, int nthreads, BasicBlock **outblocks, int *nblocks, int **invalid, int *ninvalid) {
+	Cfg *c = newCfg(bin, leaders, nleaders, nthreads);
 	
 	// Return results
-	*outblocks = blocks;
-	*nblocks = blockCount;
-	*invalid = invalidAddrs;
-	*ninvalid = invalidCount;
+	*outblocks = c->blocks;
+	*nblocks = c->nblocks;
+	*invalid = c->invalid;
+	*ninvalid = c->ninvalid;
+	c->blocks = NULL;
+	c->invalid = NULL;
+	freeCfg(c);
 }
 
 
-// return BB index containing line
+// return BB index containing line: the last to start on or before it.
 int findBBbyline(BasicBlock *blocks, int nblocks, int line) {
 	int l, r, m;
 	
 	l = 0;
 	r = nblocks;
 	
-	while (l <= r) {
+	while (l < r) {
 		m = l + (r - l) / 2;
+		if (blocks[m].lineno <= line)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l > 0 ? l - 1 : 0;
+}
+
+static int linesin(BasicBlock *b) {
+	return b->isdata ? b->nlines : b->ninstr;
+}
 
-		if (line >= blocks[m].lineno  && line < blocks[m+1].lineno)
-			return m;
- 
-		if (blocks[m].lineno < line )
+/*
+	Indexes the lines of the listing of blocks, so that lines and addresses
+	convert with a binary search and no decoding.  Blocks carry their first
+	line; this adds the address of every instruction, block by block.  The
+	blocks must not change while the index is in use.
+
+	The searches only look at block ends and first lines, so those are
+	copied out into arrays of their own, and a page map narrows an address
+	search to the blocks ending in one page; another does the same for
+	lines.  Overlapping decodes can leave ends out of order, so ends holds
+	the largest end so far: a block is found by the first of those past the
+	address, as in findAddr().
+*/
+LineIndex *newLineIndex(Buffer *bin, BasicBlock *blocks, int nblocks) {
+	LineIndex *li = malloc(sizeof(LineIndex));
+	li->blocks = blocks;
+	li->nblocks = nblocks;
+	li->first = malloc(sizeof(int) * (nblocks + 1));
+	li->ends = malloc(sizeof(int) * (nblocks + 1));
+	li->linenos = malloc(sizeof(int) * (nblocks + 1));
+	int ninstrs = 0, maxend = INT_MIN;
+	for(int i = 0; i < nblocks; i++) {
+		li->first[i] = ninstrs;
+		if (!blocks[i].isdata) ninstrs += blocks[i].ninstr;
+		if (blocks[i].end > maxend) maxend = blocks[i].end;
+		li->ends[i] = maxend;
+		li->linenos[i] = blocks[i].lineno;
+	}
+	li->first[nblocks] = ninstrs;
+	li->addrs = malloc(sizeof(int) * (ninstrs + 1));
+	for(int i = 0; i < nblocks; i++) {
+		if (blocks[i].isdata) continue;
+		int addr = blocks[i].begin;
+		for(int k = 0; k < blocks[i].ninstr; k++) {
+			Flow f;
+			li->addrs[li->first[i] + k] = addr;
+			decodeflow(bin, addr, &f);
+			addr += f.nbytes;
+		}
+	}
+	li->nlines = nblocks > 0 ? blocks[nblocks-1].lineno + linesin(&blocks[nblocks-1]) : 0;
+
+	// Pages grow until there are about as many as blocks.
+	li->pagelo = nblocks > 0 ? blocks[0].begin : 0;
+	li->pageshift = PAGESHIFT;
+	long span = nblocks > 0 ? (long)maxend - li->pagelo : 0;
+	while ((span >> li->pageshift) > nblocks)
+		li->pageshift++;
+	li->npages = (span >> li->pageshift) + 1;
+	li->page = malloc(sizeof(int) * (li->npages + 1));
+	li->shared = 0;
+	int bb = 0;
+	for(int p = 0; p <= li->npages; p++) {
+		long addr = li->pagelo + ((long)p << li->pageshift);
+		while (bb < nblocks && li->ends[bb] <= addr)
+			bb++;
+		li->page[p] = bb;
+	}
+	li->lineshift = 0;
+	while ((li->nlines >> li->lineshift) > nblocks)
+		li->lineshift++;
+	li->nlinepages = (li->nlines >> li->lineshift) + 1;
+	li->linepage = malloc(sizeof(int) * (li->nlinepages + 1));
+	bb = 0;
+	for(int p = 0; p <= li->nlinepages; p++) {
+		long line = (long)p << li->lineshift;
+		while (bb < nblocks && li->linenos[bb] <= line)
+			bb++;
+		li->linepage[p] = bb;
+	}
+	return li;
+}
+
+void freeLineIndex(LineIndex *li) {
+	if (li->shared) return;
+	free(li->first);
+	free(li->addrs);
+	free(li->ends);
+	free(li->linenos);
+	free(li->page);
+	free(li->linepage);
+	free(li);
+}
+
+// The first block ending past addr, or nblocks.
+int findBlockByAddr(LineIndex *li, int addr) {
+	int l = 0, r = li->page[0];
+	if (addr >= li->pagelo) {
+		long p = ((long)addr - li->pagelo) >> li->pageshift;
+		if (p >= li->npages)
+			return li->nblocks;
+		l = li->page[p];
+		r = li->page[p+1];
+	}
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (li->ends[m] <= addr)
 			l = m + 1;
 		else
 			r = m;
@@ -273,22 +798,53 @@ int findBBbyline(BasicBlock *blocks, int nblocks, int line) {
 	return l;
 }
 
-int linetoaddr(Buffer *bin, BasicBlock *blocks, int nblocks, int line) {
-	if (line == 95) {
-		printf("");
+// The block containing line: the last to start on or before it.
+int findBlockByLine(LineIndex *li, int line) {
+	int l = 0, r = li->nblocks;
+	if (line >= 0 && (line >> li->lineshift) < li->nlinepages) {
+		l = li->linepage[line >> li->lineshift];
+		r = li->linepage[(line >> li->lineshift) + 1];
+	}
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (li->linenos[m] <= line)
+			l = m + 1;
+		else
+			r = m;
 	}
-	int bb = findBBbyline(blocks, nblocks, line);
-	if (blocks[bb].isdata) {
-		return blocks[bb].begin; // blocks[bb].end - blocks[bb].begin;
+	return l > 0 ? l - 1 : 0;
+}
+
+// The address shown on line; past the end of a block, the end of the block.
+int linetoaddr(LineIndex *li, int line) {
+	if (li->nblocks == 0) return 0;
+	int bb = findBlockByLine(li, line);
+	BasicBlock *b = &li->blocks[bb];
+	int k = line - b->lineno;
+	if (k < 0) k = 0;
+	if (k >= linesin(b)) return b->end;
+	if (b->isdata)
+		return k == 0 ? b->begin : (b->begin & ~0xf) + 16 * k;
+	return li->addrs[li->first[bb] + k];
+}
+
+// The line showing addr, or the next one if addr is inside an instruction; -1 if there is none.
+int addrtoline(LineIndex *li, int addr) {
+	int bb = findBlockByAddr(li, addr);
+	if (bb == li->nblocks) return -1;
+	BasicBlock *b = &li->blocks[bb];
+	if (b->isdata) {
+		if (addr < b->begin) return b->lineno;
+		return b->lineno + ((addr & ~0xf) - (b->begin & ~0xf)) / 16;
 	}
-	Instruction instr;
-	int lineno = blocks[bb].lineno; 
-	int addr = blocks[bb].begin;
-	while (lineno != line && addr < blocks[bb].end) {
-		Labels labels = {.len = 0};
-		disasmone(bin, addr, &instr, &labels);
-		addr += instr.nbytes;
-		lineno++;
+	int *addrs = li->addrs + li->first[bb];
+	int l = 0, r = b->ninstr;
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (addrs[m] < addr)
+			l = m + 1;
+		else
+			r = m;
 	}
-	return addr;
+	return b->lineno + l;
 }
@@ -0,0 +1,383 @@
+/*
+	Benchmarks for the decoder, the analysis, the listing and the display's
+	line lookups, on the real images and on synthetic ones.  Results are
+	written as JSON, one flat object of metrics, and can be compared with a
+	baseline saved earlier from the same machine:
+
+		dis-bench [-o results.json] [-b baseline.json] [-t percent] [-j threads]
+
+	Exits 1 if any metric is more than the threshold (default 10%) worse than
+	its baseline.  Metrics ending in _per_s are better higher; all others,
+	times and sizes, are better lower.  Run from the directory holding the
+	images; leaders.txt is used if it is there.  `make bench` runs it.
+*/
+#define _POSIX_C_SOURCE 200809L // getopt, fdopen
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "dat.h"
+
+#define MAXMETRICS 128
+#define SYNTHLEN (4 << 20) // Bytes in each synthetic image
+#define REPS 3 // Timings are the best of this many.
+#define SAMPLES 20000 // Latency samples
+#define BATCH 16 // Lookups per latency sample: one alone is below the clock's resolution.
+#define SCREEN 60 // Rows of a display screen
+
+typedef struct {
+	char name[64];
+	double value;
+} Metric;
+
+typedef struct {
+	char *name;
+	Buffer *(*make)(int **leaders, int *nleaders);
+} Image;
+
+static int nthreads;
+
+void panic(char *s, ...) {
+	va_list args;
+	va_start(args, s);
+	vfprintf(stderr, s, args);
+	va_end(args);
+	exit(1);
+}
+
+static long maxrsskb(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss; // Kilobytes on Linux; bytes on macOS, so compare like with like.
+}
+
+// xorshift64: synthetic images and samples are the same on every run.
+static uint64_t rng = 88172645463325252ULL;
+static uint32_t rnd(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng >> 32;
+}
+
+static int resetvector(Buffer *buf, int at) {
+	int a = 0;
+	for(int i = 0; i < 4; i++)
+		a = (a << 8) | bufferGetAt(buf, at + i);
+	return a;
+}
+
+static void mapfile(Buffer *buf, char *section, int addr, char *name, char *altname) {
+	if (bufferMapFile(buf, section, addr, name) < 0 && bufferMapFile(buf, section, addr, altname) < 0)
+		panic("Could not open %s\n", name);
+}
+
+// Both images, as the disassembler maps them.
+static Buffer *makew2sys(int **leaders, int *nleaders) {
+	Buffer *buf = newBuffer();
+	bufferAddSection(buf, 0, 0x20000, "RAM");
+	bufferAddSection(buf, 0xf00000, 0x20000, "ROM");
+	mapfile(buf, "ROM", 0xf00000, "waldorfwave-boot.bin", "waldorfwave-boot.BIN");
+	mapfile(buf, "RAM", 0x1000, "W2SYS.BIN", "w2sys.bin");
+	int cap = 16;
+	*leaders = malloc(sizeof(int) * cap);
+	*nleaders = 0;
+	(*leaders)[(*nleaders)++] = resetvector(buf, 0xf00004);
+	FILE *fp = fopen("leaders.txt", "r");
+	unsigned num;
+	while (fp != NULL && fscanf(fp, "%x", &num) == 1) {
+		if (*nleaders == cap) {
+			cap *= 2;
+			*leaders = realloc(*leaders, sizeof(int) * cap);
+		}
+		(*leaders)[(*nleaders)++] = num;
+	}
+	if (fp != NULL) fclose(fp);
+	return buf;
+}
+
+// The boot ROM alone, from its reset vector.
+static Buffer *makeboot(int **leaders, int *nleaders) {
+	Buffer *buf = newBuffer();
+	bufferAddSection(buf, 0xf00000, 0x20000, "ROM");
+	mapfile(buf, "ROM", 0xf00000, "waldorfwave-boot.bin", "waldorfwave-boot.BIN");
+	*leaders = malloc(sizeof(int));
+	(*leaders)[0] = resetvector(buf, 0xf00004);
+	*nleaders = 1;
+	return buf;
+}
+
+static Buffer *synthbuffer(void) {
+	Buffer *buf = newBuffer();
+	bufferAddSection(buf, 0, SYNTHLEN, "SYNTH");
+	sectionReserve(&buf->sections[0], SYNTHLEN);
+	return buf;
+}
+
+// Random bytes, entered every 64K: mostly short blocks and invalid code.
+static Buffer *makerandom(int **leaders, int *nleaders) {
+	Buffer *buf = synthbuffer();
+	unsigned char *p = buf->sections[0]._bytes;
+	for(int i = 0; i < SYNTHLEN; i++)
+		p[i] = rnd();
+	*nleaders = SYNTHLEN / 0x10000;
+	*leaders = malloc(sizeof(int) * *nleaders);
+	for(int i = 0; i < *nleaders; i++)
+		(*leaders)[i] = i * 0x10000;
+	return buf;
+}
+
+// Valid code end to end: moves, arithmetic, extension words and short
+// branches over the next instruction, with an RTS to finish.
+static Buffer *makedense(int **leaders, int *nleaders) {
+	static const uint16_t code[][4] = {
+		{1, 0x2200},	// MOVE.L D0,D1
+		{1, 0x5240},	// ADDQ.W #1,D0
+		{2, 0x43e8, 0x1234},	// LEA $1234(A0),A1
+		{2, 0x343c, 0x00ff},	// MOVE.W #$00ff,D2
+		{1, 0xb481},	// CMP.L D1,D2
+		{2, 0x6602, 0x4e71},	// BNE.S *+4; NOP
+		{2, 0x48e7, 0xff00},	// MOVEM.L D0-D7,-(A7)
+		{3, 0x23c0, 0x0000, 0x1000},	// MOVE.L D0,$00001000
+		{2, 0x3028, 0x0010},	// MOVE.W 16(A0),D0
+		{1, 0xd081},	// ADD.L D1,D0
+		{1, 0xe348},	// LSL.W #1,D0
+		{2, 0x0c40, 0x0010},	// CMPI.W #$0010,D0
+	};
+	int n = sizeof(code) / sizeof(code[0]);
+	Buffer *buf = synthbuffer();
+	unsigned char *p = buf->sections[0]._bytes;
+	int at = 0;
+	while (at + 8 < SYNTHLEN) {
+		const uint16_t *c = code[rnd() % n];
+		for(int i = 1; i <= c[0]; i++) {
+			p[at++] = c[i] >> 8;
+			p[at++] = c[i];
+		}
+	}
+	p[at++] = 0x4e; // RTS
+	p[at++] = 0x75;
+	*leaders = malloc(sizeof(int));
+	(*leaders)[0] = 0;
+	*nleaders = 1;
+	return buf;
+}
+
+static Image images[] = {
+	{"w2sys", makew2sys},
+	{"boot", makeboot},
+	{"random", makerandom},
+	{"dense", makedense},
+};
+
+static void report(FILE *out, char *image, char *metric, double value) {
+	fprintf(out, "%s.%s %.17g\n", image, metric, value);
+}
+
+static int dblcmp(const void *a, const void *b) {
+	double x = *(double *)a, y = *(double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double *v, int n, double p) {
+	qsort(v, n, sizeof(double), dblcmp);
+	return v[(int)(p * (n - 1))];
+}
+
+// Measures one image, writing "image.metric value" lines to out.
+static void measure(Image *im, FILE *out) {
+	int *leaders, nleaders;
+	Buffer *buf = im->make(&leaders, &nleaders);
+
+	// The analysis
+	BasicBlock *blocks = NULL;
+	int nblocks, *invalid, ninvalid;
+	long rss0 = maxrsskb();
+	double best = 1e30;
+	for(int r = 0; r < REPS; r++) {
+		if (blocks) {
+			free(blocks);
+			free(invalid);
+		}
+		double t = now();
+		findBasicBlocks(buf, leaders, nleaders, nthreads, &blocks, &nblocks, &invalid, &ninvalid);
+		t = now() - t;
+		if (t < best) best = t;
+	}
+	report(out, im->name, "findbb_s", best);
+	report(out, im->name, "findbb_peak_kb", maxrsskb() - rss0);
+
+	Labels *labels = newLabels(1);
+	generateLabels(labels, blocks, nblocks);
+	LineIndex *li = newLineIndex(buf, blocks, nblocks);
+
+	// The decoder, without the instruction cache, on every code instruction
+	Decoder *d = newDecoder(buf);
+	int ninstrs = li->first[nblocks];
+	best = 1e30;
+	for(int r = 0; r < REPS; r++) {
+		double t = now();
+		for(int i = 0; i < ninstrs; i++) {
+			Instruction in;
+			if (disasmone(d, li->addrs[i], &in, labels)) {
+				free(in.asm);
+				free(in.instr);
+			}
+		}
+		t = now() - t;
+		if (t < best) best = t;
+	}
+	report(out, im->name, "disasmone_per_s", ninstrs / best);
+
+	// The listing, with the cache, as the disassembler makes it
+	buf->icache = newICache(buf);
+	FILE *null = fopen("/dev/null", "w");
+	best = 1e30;
+	for(int r = 0; r < REPS; r++) {
+		double t = now();
+		writelisting(null, buf, blocks, nblocks, labels, nthreads);
+		t = now() - t;
+		if (t < best) best = t;
+	}
+	fclose(null);
+	report(out, im->name, "listing_s", best);
+
+	// Line lookups, and formatting a screen of lines as the display does.
+	// Percentiles too are the best of REPS passes: one pass is at the mercy
+	// of whatever else the machine is doing.
+	double *ns = malloc(sizeof(double) * SAMPLES);
+	double p50 = 1e30, p99 = 1e30;
+	int lines[BATCH];
+	volatile int sink = 0;
+	for(int r = 0; r < REPS; r++) {
+		for(int s = 0; s < SAMPLES; s++) {
+			for(int i = 0; i < BATCH; i++)
+				lines[i] = rnd() % li->nlines;
+			double t = now();
+			for(int i = 0; i < BATCH; i++)
+				sink += linetoaddr(li, lines[i]);
+			ns[s] = (now() - t) * 1e9 / BATCH;
+		}
+		p50 = fmin(p50, percentile(ns, SAMPLES, 0.5));
+		p99 = fmin(p99, percentile(ns, SAMPLES, 0.99));
+	}
+	report(out, im->name, "linetoaddr_p50_ns", p50);
+	report(out, im->name, "linetoaddr_p99_ns", p99);
+	View *v = newView(d, li, labels, SCREEN);
+	int nscreens = SAMPLES / 10;
+	p50 = p99 = 1e30;
+	for(int r = 0; r < REPS; r++) {
+		for(int s = 0; s < nscreens; s++) {
+			int top = rnd() % li->nlines;
+			viewSetLines(v, li); // Start cold, as after a jump.
+			double t = now();
+			for(int i = 0; i < SCREEN; i++)
+				sink += viewLine(v, top + i) != NULL;
+			ns[s] = (now() - t) * 1e9 / SCREEN;
+		}
+		p50 = fmin(p50, percentile(ns, nscreens, 0.5));
+		p99 = fmin(p99, percentile(ns, nscreens, 0.99));
+	}
+	report(out, im->name, "viewline_p50_ns", p50);
+	report(out, im->name, "viewline_p99_ns", p99);
+	(void)sink;
+}
+
+// Reads a flat JSON object of numbers, as written by writejson().
+static int readjson(char *name, Metric *m) {
+	FILE *fp = fopen(name, "r");
+	if (fp == NULL) return -1;
+	int n = 0, c;
+	while (n < MAXMETRICS && (c = fgetc(fp)) != EOF) {
+		if (c != '"') continue;
+		if (fscanf(fp, "%63[^\"]\": %lf", m[n].name, &m[n].value) == 2)
+			n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+static void writejson(FILE *fp, Metric *m, int n) {
+	fprintf(fp, "{\n");
+	for(int i = 0; i < n; i++)
+		fprintf(fp, "\t\"%s\": %.6g%s\n", m[i].name, m[i].value, i < n-1 ? "," : "");
+	fprintf(fp, "}\n");
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL, *basename = NULL;
+	double threshold = 10;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:j:o:t:")) != -1) {
+		switch(opt) {
+		case 'b': basename = optarg; break;
+		case 'j': nthreads = atoi(optarg); break;
+		case 'o': outname = optarg; break;
+		case 't': threshold = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: dis-bench [-o results.json] [-b baseline.json] [-t percent] [-j threads]\n");
+			exit(2);
+		}
+	}
+
+	// Each image in a process of its own, so its peak memory is its own.
+	Metric m[MAXMETRICS];
+	int n = 0;
+	for(int i = 0; i < (int)(sizeof(images) / sizeof(images[0])); i++) {
+		int fd[2];
+		if (pipe(fd) < 0) panic("pipe\n");
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(fd[0]);
+			FILE *out = fdopen(fd[1], "w");
+			measure(&images[i], out);
+			fclose(out);
+			exit(0);
+		}
+		close(fd[1]);
+		FILE *in = fdopen(fd[0], "r");
+		while (n < MAXMETRICS && fscanf(in, "%63s %lf", m[n].name, &m[n].value) == 2) {
+			fprintf(stderr, "%-32s %12.6g\n", m[n].name, m[n].value);
+			n++;
+		}
+		fclose(in);
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			panic("%s failed\n", images[i].name);
+	}
+
+	if (outname != NULL) {
+		FILE *fp = fopen(outname, "w");
+		if (fp == NULL) panic("Could not write %s\n", outname);
+		writejson(fp, m, n);
+		fclose(fp);
+	} else
+		writejson(stdout, m, n);
+
+	if (basename == NULL) return 0;
+	Metric base[MAXMETRICS];
+	int nbase = readjson(basename, base);
+	if (nbase < 0) {
+		fprintf(stderr, "No baseline %s: nothing to compare\n", basename);
+		return 0;
+	}
+	int worse = 0;
+	for(int i = 0; i < n; i++) {
+		for(int j = 0; j < nbase; j++) {
+			if (strcmp(m[i].name, base[j].name) != 0 || base[j].value == 0) continue;
+			double change = 100 * (m[i].value - base[j].value) / base[j].value;
+			int higher = strstr(m[i].name, "_per_s") != NULL;
+			if (higher ? change < -threshold : change > threshold) {
+				fprintf(stderr, "REGRESSION %-32s %12.6g -> %12.6g (%+.1f%%)\n", m[i].name, base[j].value, m[i].value, change);
+				worse++;
+			}
+		}
+	}
+	fprintf(stderr, "%d of %d metrics regressed by more than %g%% against %s\n", worse, n, threshold, basename);
+	return worse > 0;
+}
@@ -1,8 +1,13 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, pread, strdup
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "dat.h"
 
 
@@ -11,7 +16,6 @@ Section *newSection(void) {
 	Section *b = malloc(sizeof(Section));
 	b->_bytes = 0;
 	b->_len = 0;
-	b->_curptr = b->_bytes;
 	b->_name = strdup("noname");
 	b->_baseaddress = 0;
 	return b;
@@ -21,25 +25,10 @@ Section *sectionReserve(Section *b, int len) {
 	if (b->_bytes) free(b->_bytes);
 	b->_bytes = malloc(len);
 	b->_len = len;
-	b->_curptr = b->_bytes;
 	memset(b->_bytes, 0, b->_len);
 	return b;
 }
 
-int sectionGetCh(Section *b) {
-	if (b->_curptr + 1 >= b->_bytes + b->_len) {
-		return -1;
-	}
-	return *(b->_curptr++);
-}
-
-int sectionSeek(Section *b, int addr) {
-	if (addr < 0) return b->_curptr - b->_bytes;
-	if (addr - b->_baseaddress >= b->_len) return -1;
-	b->_curptr = b->_bytes + addr - b->_baseaddress;
-	return addr;
-}
-
 int sectionLen(Section *b) {
 	return b->_len;
 }
@@ -49,85 +38,135 @@ int sectionGetAt(Section *b, int pos) {
 	return b->_bytes[pos];
 }
 
-int sectionIsEOF(Section *b) {
-	return b->_curptr >= b->_bytes+b->_len;
-}
-
 Buffer *newBuffer(void) {
 	Buffer *b = malloc(sizeof(Buffer));
 	b->cap = 16;
 	b->sections = malloc(sizeof(Section) * b->cap);
 	b->len = 0;
+	b->last = 0;
+	b->icache = NULL;
 	return b;
 }
 
-int bufferSeek(Buffer *b, int addr) {
-	b->curaddress = addr;
-	for(int s = 0; s < b->len; s++) {
-		if (b->sections[s]._baseaddress <= addr && addr < b->sections[s]._baseaddress + b->sections[s]._len) {
-			return sectionSeek(&b->sections[s], addr);
-		}
-	}
-	return -1;
-}
-
 int bufferLen(Buffer *b /*, int section*/) {
 	return b->sections[0]._len;
 }
 
-int bufferGetCh(Buffer *b) {
-	int addr = b->curaddress++;
-	for(int s = 0; s < b->len; s++) {
-		if (b->sections[s]._baseaddress <= addr && addr < b->sections[s]._baseaddress + b->sections[s]._len) {
-			int ret = sectionGetCh(&b->sections[s]);
-			if (ret != -1) return ret;
-			// look in the next section.
-		}
-	}
-	if (addr < b->sections[b->len-1]._baseaddress + b->sections[b->len-1]._len) {
-		assert(!!"Should not be here");
+// Stateless, so any number of readers can share the buffer.
+int bufferRead(Buffer *b, int addr) {
+	STAT(bufferreads);
+	int s = bufferSectionByAddr(b, addr);
+	if (s >= 0)
+		return sectionGetAt(&b->sections[s], addr-b->sections[s]._baseaddress);
+	if (addr < bufferEndAddress(b))
 		return 0; // Unmapped memory
-	}
 	return -1;
 }
 
 int bufferGetAt(Buffer *b, int offset) {
-	for(int s = 0; s < b->len; s++) {
-		if (b->sections[s]._baseaddress <= offset && offset < b->sections[s]._baseaddress + b->sections[s]._len)
-			return sectionGetAt(&b->sections[s], offset-b->sections[s]._baseaddress);
-	}
+	STAT(bufferreads);
+	int s = bufferSectionByAddr(b, offset);
+	if (s >= 0)
+		return sectionGetAt(&b->sections[s], offset-b->sections[s]._baseaddress);
 	panic("bufferGetAt offset %d not mapped\n", offset);
 	return -1;
 }
 
 int bufferIsEOF(Buffer *b, int addr) {
-	return (addr >= b->sections[b->len-1]._baseaddress + b->sections[b->len-1]._len);
+	return (addr >= b->sections[b->len-1]._baseaddress + (int)b->sections[b->len-1]._len);
+}
+
+static int insection(Section *s, int addr) {
+	return s->_baseaddress <= addr && addr < s->_baseaddress + (int)s->_len;
+}
+
+// Binary search: the index of the first section starting above addr.
+static int firstSectionAfter(Buffer *b, int addr) {
+	int l = 0, r = b->len;
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (b->sections[m]._baseaddress <= addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l;
 }
 
+// Sections are kept sorted by address and must not overlap.
 void bufferAddSection(Buffer *b, int base, int len, char *name) {
-	Section *s = newSection();
-	s->_name = name;
-	s->_len = len;
-	s->_baseaddress = base;
-	s->_curptr = s->_bytes;
+	Section s = {._bytes = 0, ._len = len, ._name = name, ._baseaddress = base};
 	
-	if (b->len + 1 >= b->cap) {
-		panic("Increase section array size");
+	if (b->len == b->cap) {
+		b->cap *= 2;
+		b->sections = realloc(b->sections, sizeof(Section) * b->cap);
 	}
 	
 	// Insert in sorted order
-	int i;
-	for(i = 0; i < b->len; i++) {
-		if (b->sections[i]._baseaddress < s->_baseaddress && s->_baseaddress < b->sections[i]._baseaddress + len) {						for(int j = b->len; j > i; j++) {
-				b->sections[j] = b->sections[j-1];
-			}
-			break;
-		}
+	int i = firstSectionAfter(b, base);
+	if ((i > 0 && base < b->sections[i-1]._baseaddress + (int)b->sections[i-1]._len) ||
+	    (i < b->len && b->sections[i]._baseaddress < base + len)) {
+		panic("Section %s at %06x overlaps another\n", name, base);
 	}
-	b->sections[i] = *s;
+	memmove(&b->sections[i+1], &b->sections[i], sizeof(Section) * (b->len - i));
+	b->sections[i] = s;
 	b->len++;
 }
 
+/*
+	Maps filename into the named section at loadaddr, without copying it: the
+	mapping is private, so patched bytes are copied on write.  The section
+	then ends where the file does.  Anything between the section base and
+	loadaddr reads as zero, from anonymous pages the kernel fills on demand.
+	Returns 0, or -1 with errno set.
+*/
+int bufferMapFile(Buffer *b, char *sectionName, int loadaddr, char *filename) {
+	int sec = bufferSectionByName(b, sectionName);
+	if (sec < 0 || loadaddr < b->sections[sec]._baseaddress) {
+		errno = EINVAL;
+		return -1;
+	}
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return -1;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	size_t off = loadaddr - b->sections[sec]._baseaddress;
+	size_t len = off + st.st_size;
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	// Keep a zero byte past the end, as the old read loop did.
+	size_t maplen = (len + 1 + pagesize - 1) & ~(pagesize - 1);
+	unsigned char *p = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size > 0) {
+		int ok;
+		if (off % pagesize == 0) {
+			ok = mmap(p + off, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0) != MAP_FAILED;
+		} else {
+			// A file mapping must start on a page, so copy this one.
+			ok = pread(fd, p + off, st.st_size, 0) == st.st_size;
+		}
+		if (!ok) {
+			int e = errno;
+			munmap(p, maplen);
+			close(fd);
+			errno = e;
+			return -1;
+		}
+	}
+	close(fd);
+
+	b->sections[sec]._bytes = p;
+	b->sections[sec]._len = len;
+	return 0;
+}
+
 int bufferSectionByName(Buffer *b, char *name) {
 	for(int i=0; i < b->len; i++) {
 		if (strcmp(name, b->sections[i]._name) == 0) {
@@ -137,20 +176,20 @@ int bufferSectionByName(Buffer *b, char *name) {
 	return -1;
 }
 
+// Consecutive lookups mostly land in one section, so the last one found is tried first.
 int bufferSectionByAddr(Buffer *b, int addr) {
-	for(int s = 0; s < b->len; s++) {
-		if (b->sections[s]._baseaddress <= addr && addr < b->sections[s]._baseaddress + b->sections[s]._len)
-			return s;
-	}
-	return -1;
+	int s = __atomic_load_n(&b->last, __ATOMIC_RELAXED);
+	if (s < b->len && insection(&b->sections[s], addr))
+		return s;
+	s = firstSectionAfter(b, addr) - 1;
+	if (s < 0 || !insection(&b->sections[s], addr))
+		return -1;
+	__atomic_store_n(&b->last, s, __ATOMIC_RELAXED);
+	return s;
 }
 
 int bufferIsMappedAddress(Buffer *b, int addr) {
-	for(int s = 0; s < b->len; s++) {
-		if (b->sections[s]._baseaddress <= addr && addr < b->sections[s]._baseaddress + b->sections[s]._len)
-			return 1;
-	}
-	return 0;
+	return bufferSectionByAddr(b, addr) >= 0;
 }
 
 int bufferEndAddress(Buffer *b) {
@@ -1,16 +1,29 @@
+#include <stdint.h>
+
+typedef struct Adb Adb;
 typedef struct BasicBlock BasicBlock;
 typedef struct Buffer Buffer;
+typedef struct Cfg Cfg;
+typedef struct Decoder Decoder;
+typedef struct Flow Flow;
+typedef struct ICache ICache;
 typedef struct IList IList;
 typedef struct Instruction Instruction;
 typedef struct Label Label;
 typedef struct Labels Labels;
+typedef struct LineIndex LineIndex;
+typedef struct Operand Operand;
 typedef struct Program Program;
 typedef struct Section Section;
+typedef struct Stats Stats;
+typedef struct View View;
+typedef struct ViewLine ViewLine;
+typedef struct Xref Xref;
+typedef struct Xrefs Xrefs;
 
 struct Section {
 	unsigned char *_bytes;
 	size_t _len;
-	unsigned char *_curptr;
 	char *_name;
 	int _baseaddress;
 };
@@ -19,18 +32,20 @@ struct Buffer {
 	Section *sections;
 	int len;
 	int cap;
-	int curaddress;
+	int last; // Hint: the section bufferSectionByAddr() found last.
+	ICache *icache; // Decoded instructions, or NULL; see icache.c.
 };
 
 Buffer *newBuffer(void);
-int bufferGetCh(Buffer *b);
-int bufferSeek(Buffer *b, int offset); // Negative offset returns current.
 int bufferLen(Buffer *b);
 int bufferGetAt(Buffer *b, int offset);
+int bufferRead(Buffer *b, int addr); // Unmapped memory reads as 0, past the end as -1.
 int bufferIsEOF(Buffer *b, int addr);
 //int bufferIsEOS(Buffer *b, ); // End of Section
 void bufferAddSection(Buffer *b, int base, int len, char *name);
-void bufferIsMappedAddr(Buffer *b, int addr); // Check that addr is in a segment.
+Section *sectionReserve(Section *b, int len); // Gives it len zero bytes of its own.
+int bufferMapFile(Buffer *b, char *sectionName, int loadaddr, char *filename);
+int bufferIsMappedAddress(Buffer *b, int addr); // Check that addr is in a segment.
 // don't cache these: the indices change when sections are added.
 int bufferSectionByName(Buffer *b, char *name);
 int bufferSectionByAddr(Buffer *b, int addr);
@@ -43,10 +58,27 @@ struct Label {
 	int generated;
 };
 
+typedef struct {
+	int addr;
+	int idx; // into Labels.labels; -1 for an empty slot
+} LabelSlot;
+
+typedef struct {
+	unsigned int hash;
+	int addr; // of the label with this name
+	int state; // NAMEFREE, NAMEUSED or NAMEGONE
+} NameSlot;
+
 struct Labels {
-	Label *labels;
+	Label *labels; // sorted by address
 	int len;
 	int cap;
+	LabelSlot *byaddr; // hash index of labels by address, added to by addLabel
+	int hashcap; // power of two, at least twice len
+	NameSlot *byname; // hash index by name, kept in step by addLabel and renames
+	int namecap; // power of two
+	int nnameslots; // used and gone
+	Label *byprefix; // copies of labels in name order, for prefix lookup; NULL when stale
 };
 
 struct BasicBlock {
@@ -57,6 +89,22 @@ struct BasicBlock {
 	int nbytes;
 };
 
+struct LineIndex {
+	BasicBlock *blocks;
+	int nblocks;
+	int *first; // per block, the index in addrs of its first instruction
+	int *addrs; // instruction addresses, block by block
+	int nlines;
+	// Search keys, apart from the blocks so a search touches nothing else.
+	int *ends; // per block, the largest end up to it
+	int *linenos; // per block, its first line
+	int *page; // per page, the first block ending past its start
+	int pagelo, pageshift, npages;
+	int *linepage; // per page of lines, the first block starting past it
+	int lineshift, nlinepages;
+	int shared; // Belongs to an Adb: freeLineIndex() leaves it be.
+};
+
 struct Program {
 	Buffer bin;
 	Labels labels;
@@ -67,10 +115,14 @@ struct Program {
 
 Labels *newLabels(int cap);
 void addLabel(Labels *ls, char *name, int addr, int generated); // Strdups the name
+void deleteLabel(Labels *ls, int addr);
 void freadLabels(FILE *fp, Labels *);
+void mergeLabels(Labels *ls, Label *add, int n, int replace); // Takes the names.
+void generateLabels(Labels *ls, BasicBlock *blocks, int nblocks); // L<addr> for blocks with no label
 int searchLabelsByAddr(Labels *labels, int key); // Return insertion point
-int findLabelByAddr(Labels *labels, int key); // Return -1 if not found
+int findLabelByAddr(Labels *labels, int key); // Return -1 if not found. O(1).
 int findLabelByName(Labels *labels, char *key); // Return -1 if not found
+int findLabelByPrefix(Labels *labels, char *prefix, int *nmatches); // First match in name order, or -1
 
 extern void loadmap(char *name);
 
@@ -87,6 +139,51 @@ enum OperandType {
 	MEMORY = 3,
 };
 
+#define NOSIZE 3 // Size suffix of an unsized instruction.
+#define MAXINSTRTEXT 512 // Room for one formatted instruction.
+
+enum Mnemonic {
+	M_INVALID = 0,
+	M_ABCD, M_ADD, M_ADDA, M_ADDI, M_ADDQ, M_ADDX, M_AND, M_ANDI,
+	M_ASL, M_ASR, M_BCC, M_BCHG, M_BCLR, M_BSET, M_BTST, M_CHK,
+	M_CLR, M_CMP, M_CMPA, M_CMPI, M_CMPM, M_DBCC, M_DIVS, M_DIVU,
+	M_EOR, M_EORI, M_EXG, M_EXT, M_JMP, M_JSR, M_LEA, M_LINK,
+	M_LSL, M_LSR, M_MOVE, M_MOVEA, M_MOVEM, M_MOVEP, M_MOVEQ, M_MULS,
+	M_MULU, M_NBCD, M_NEG, M_NEGX, M_NOP, M_NOT, M_OR, M_ORI,
+	M_PEA, M_RESET, M_ROL, M_ROR, M_ROXL, M_ROXR, M_RTE, M_RTR,
+	M_RTS, M_SBCD, M_SCC, M_STOP, M_SUB, M_SUBA, M_SUBI, M_SUBQ,
+	M_SUBX, M_SWAP, M_TAS, M_TRAP, M_TRAPV, M_TST, M_UNLK,
+	NMNEMONICS
+};
+
+enum OperandKind {
+	OPK_NONE = 0,
+	OPK_EA,	// Effective address: mode 0..12 as from getmode(), register, extension data
+	OPK_IMM,	// Immediate of the operand size, listed without a label
+	OPK_QUICK,	// Small constant: ADDQ/SUBQ, shift counts, bit numbers
+	OPK_MOVEQ,
+	OPK_TRAP,
+	OPK_LINK,	// LINK displacement
+	OPK_MOVEP,	// d16(An) of MOVEP
+	OPK_REGLIST,	// MOVEM mask, bit 0 = D0 .. bit 15 = A7
+	OPK_BRANCH,	// Bcc/DBcc displacement; size 0 for a short branch
+	OPK_SR,
+	OPK_CCR,
+	OPK_USP,
+};
+
+// One decoded operand
+struct Operand {
+	uint8_t kind;	// enum OperandKind
+	uint8_t mode;	// OPK_EA addressing mode
+	uint8_t reg;
+	uint8_t size;	// 0 = byte, 1 = word, 2 = long
+	int32_t value;	// displacement, immediate, count, register mask...
+	uint16_t index;	// index extension word of modes 6 and 10
+	uint8_t hasabs;	// absaddr is an address worth a label
+	uint32_t absaddr;	// resolved address: absolute, PC relative, long immediate, branch target
+};
+
 // Representation of a m68k instruction
 struct Instruction {
 	char *asm;
@@ -102,6 +199,23 @@ struct Instruction {
 	enum OperandType src, dst;
 	enum IncrType prepost; 
 	int soperand, doperand;	// operands - Data register 
+
+	// Structured decoding, filled by decodeone().
+	uint16_t word;	// first opcode word
+	uint8_t mnemonic;	// enum Mnemonic
+	uint8_t size;	// size suffix: 0 = .B, 1 = .W, 2 = .L, NOSIZE
+	uint8_t cc;	// condition of Bcc, DBcc and Scc
+	uint8_t nops;
+	Operand op[2];	// source, destination
+	uint8_t next;
+	uint16_t ext[4];	// extension words, in fetch order
+};
+
+// Length and control flow of one instruction, from decodeflow()
+struct Flow {
+	int nbytes;
+	int isBranch, isJump, isRet;
+	int targetAddress;
 };
 
 struct IList {
@@ -115,14 +229,162 @@ void freeIList(IList *);
 void clearIList(IList *);
 void appendInstruction(IList *, int addr, Instruction);
 
-int rundis(Buffer *bin, BasicBlock *blocks, int nblocks, Labels *labels, IList *instrs);
-extern int disasm(Buffer *bin, unsigned long int start, unsigned long int end, Labels *labels, IList *, int justOne);
-extern int disasmone(Buffer *bin, int start, Instruction *retval, Labels *labels);
-int datadump(Buffer *gBuf, uint32_t start, uint32_t end, void (*write)(char *, int addr, void *), void *d, int restrictline);
+// Decoding state of one thread.  Any number of Decoders may share a Buffer,
+// which they only read; a Decoder itself must not be shared.
+struct Decoder {
+	Buffer *bin;
+	Section *sec; // Section of the last fetch; sections must not be added while decoding.
+	uint32_t address; // Next address to fetch from.
+	uint32_t romstart;
+	int rawmode; // Output ready to re-assemble.
+	long hits, misses; // Instruction cache; added to its totals by freeDecoder().
+};
+
+ICache *newICache(Buffer *bin);
+void freeICache(ICache *c);
+int icacheLookup(ICache *c, int sec, int addr, Instruction *out, int *ok); // Returns 0 on a miss.
+void icacheInsert(ICache *c, int sec, int addr, Instruction *in, int ok);
+void icacheCount(ICache *c, long hits, long misses);
+void icacheStats(ICache *c, long *hits, long *misses, long *entries);
+
+Decoder *newDecoder(Buffer *bin);
+void freeDecoder(Decoder *d);
+
+extern int disasm(Decoder *d, unsigned long int start, unsigned long int end, Labels *labels, IList *, int justOne);
+extern int disasmone(Decoder *d, int start, Instruction *retval, Labels *labels);
+int decodeone(Decoder *d, int start, Instruction *retval); // Structure only: no labels, text or allocation.
+int decodescan(Decoder *d, int start, Instruction *retval); // decodeone() by a linear optab scan, uncached.
+void sprintinstr(Decoder *d, char *out, Instruction *in, Labels *labels); // out holds MAXINSTRTEXT.
+int decodeflow(Buffer *bin, uint32_t start, Flow *retval); // Length and control flow only.
+void buildflowtable(void);
+void buildoptable(void); // Decode table; built on first use.
+int checkoptable(void); // Compare the decode table to a linear optab scan; returns mismatches.
+int datadump(Decoder *dec, uint32_t start, uint32_t end, void (*write)(char *, int addr, void *), void *d, int restrictline);
+
+// Where datadump() lines go: a screen row or a listing file.
+typedef struct {
+	FILE *fp;
+	int row;
+	int ntab; // Tabs in front of the next line.
+} DumpOut;
+
+void myfprint(char *s, int addr, void *d); // datadump() writer for DumpOut.fp
+int listingthreads(void); // One per processor.
+void writelisting(FILE *fp, Buffer *bin, BasicBlock *blocks, int nblocks, Labels *labels, int nthreads); // nthreads 0: listingthreads()
 
-void findBasicBlocks(Buffer *bin, int *leaders, int nleaders, BasicBlock **out, int *outlen, int **invalid, int *ninvalid);
+void findBasicBlocks(Buffer *bin, int *leaders, int nleaders, int nthreads, BasicBlock **out, int *outlen, int **invalid, int *ninvalid);
+Cfg *newCfg(Buffer *bin, int *leaders, int nleaders, int nthreads); // An editable findBasicBlocks().
+void freeCfg(Cfg *c);
+BasicBlock *cfgBlocks(Cfg *c, int *nblocks);
+// Edits; each rebuilds only the blocks, lines and generated labels it affects.
+int cfgAddLeader(Cfg *c, int addr, Labels *labels);
+int cfgMarkData(Cfg *c, int begin, int end, Labels *labels); // [begin, end)
+int cfgUndo(Cfg *c, Labels *labels);
 int findAddr(int addr, BasicBlock *blocks, int nblocks);
 int findBBbyline(BasicBlock *blocks, int nblocks, int line);
-int linetoaddr(Buffer *bin, BasicBlock *blocks, int nblocks, int line);
+int datalines(int begin, int end); // Lines datadump() prints for [begin, end)
+LineIndex *newLineIndex(Buffer *bin, BasicBlock *blocks, int nblocks);
+void freeLineIndex(LineIndex *li);
+int findBlockByAddr(LineIndex *li, int addr); // findAddr() on the index
+int findBlockByLine(LineIndex *li, int line); // findBBbyline() on the index
+int linetoaddr(LineIndex *li, int line);
+int addrtoline(LineIndex *li, int addr);
+
+// A formatted listing line; see view.c.
+struct ViewLine {
+	int line; // -1 for an empty slot
+	int addr;
+	int isdata;
+	int refs[2]; // operand addresses, whose labels the text shows
+	char text[MAXINSTRTEXT]; // instruction, or datadump() row
+};
+
+View *newView(Decoder *dec, LineIndex *lines, Labels *labels, int rows);
+void freeView(View *v);
+ViewLine *viewLine(View *v, int line);
+void viewSetLines(View *v, LineIndex *lines); // The analysis changed.
+void viewLabelChanged(View *v, int addr); // Drops the lines naming addr.
+
+enum XrefKind {
+	XCALL = 0, // BSR, JSR
+	XBRANCH, // Bcc, DBcc
+	XJUMP, // JMP
+	XREAD,
+	XWRITE,
+	XADDR, // LEA, PEA, long immediate
+	NXREFKINDS
+};
+
+extern char *xrefkinds[];
+
+// An instruction at from naming to.
+struct Xref {
+	int from, to;
+	int kind; // enum XrefKind
+};
+
+// See xref.c.
+struct Xrefs {
+	Xref *byfrom; // sorted by from, then to
+	Xref *byto; // sorted by to, then from
+	int len;
+	int shared; // Belongs to an Adb: freeXrefs() leaves it be.
+};
+
+Xrefs *newXrefs(Buffer *bin, BasicBlock *blocks, int nblocks);
+void freeXrefs(Xrefs *x);
+// Both return how many refs in [begin, end) there are, from *out on.
+int xrefsTo(Xrefs *x, int begin, int end, Xref **out);
+int xrefsFrom(Xrefs *x, int begin, int end, Xref **out);
+
+// The files an analysis database is keyed by.
+enum {
+	ADBPROGRAM = 0,
+	ADBBOOT,
+	ADBLEADERS,
+	ADBLABELS,
+	NADBINPUTS
+};
+
+// An analysis database mapped in; see adb.c.
+struct Adb {
+	void *map;
+	size_t len;
+	BasicBlock *blocks;
+	int nblocks;
+	LineIndex lines;
+	Xrefs xrefs;
+};
+
+uint64_t hashfile(char *name);
+Adb *openAdb(char *name, Buffer *bin, uint64_t *hash, int *labelsok);
+void closeAdb(Adb *db);
+int saveAdb(char *name, uint64_t *hash, BasicBlock *blocks, int nblocks, LineIndex *li, Xrefs *x);
+
+double now(void); // Monotonic clock, in seconds; see stats.c.
+
+// Enable the #define below, or build with -DPRINT_STATS, for dis --stats: the
+// time each phase of a run takes, and counts of the calls that matter.
+//#define PRINT_STATS
+
+#ifdef PRINT_STATS
+// Counts of one thread; see stats.c.
+struct Stats {
+	long disasmone, decodeone, fetches, bufferreads, findlabel;
+	long ilistgrows, labelgrows; // reallocs in appendInstruction(), insertLabel()
+	Stats *next;
+};
+extern __thread Stats *statlocal;
+Stats *statRegister(void);
+void statPhase(char *name); // Ends the phase under way, and starts name's; NULL just ends it.
+void statReport(FILE *fp);
+#define STAT(counter) ((statlocal ? statlocal : statRegister())->counter++)
+#define STATPHASE(name) statPhase(name)
+#define STATREPORT(fp) statReport(fp)
+#else
+#define STAT(counter) do {} while(0)
+#define STATPHASE(name) do {} while(0)
+#define STATREPORT(fp) do {} while(0)
+#endif
 
 void panic(char *s, ...);
@@ -1,11 +1,14 @@
+#define _GNU_SOURCE // asprintf
 #include <assert.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <ncurses.h>
 #include <errno.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <setjmp.h>
 #include "dat.h"
@@ -19,105 +22,24 @@ char *infilename;
 char *labelsname;
 char *disasmname;
 char *commentsname;
+char *adbname;
 
 WINDOW *_hex, *diswin, *cmd;
 
 
-/* Size of each input chunk to be
-   read and allocate for. */
-#ifndef  READALL_CHUNK
-#define  READALL_CHUNK  262144
-#endif
-
-#define  READALL_OK          0  /* Success */
-#define  READALL_INVALID    -1  /* Invalid parameters */
-#define  READALL_ERROR      -2  /* Stream error */
-#define  READALL_TOOMUCH    -3  /* Too much input */
-#define  READALL_NOMEM      -4  /* Out of memory */
-
-/* This function returns one of the READALL_ constants above.
-   If the return value is zero == READALL_OK, then:
-	 (*dataptr) points to a dynamically allocated buffer, with
-	 (*sizeptr) chars read from the file.
-	 The buffer is allocated for one extra char, which is NUL,
-	 and automatically appended after the data.
-   Initial values of (*dataptr) and (*sizeptr) are ignored.
-*/
-int readall(FILE *in, Buffer *buf, int loadaddr, char *sectionName)
-{
-	int section = bufferSectionByName(buf, sectionName);
-	unsigned char  *data = buf->sections[section]._bytes, *temp;
-	size_t size = buf->sections[section]._len;
-	size_t used = loadaddr - buf->sections[section]._baseaddress;
-	size_t n;
-
-	/* None of the parameters can be NULL. */
-	if (in == NULL || buf == NULL)
-		return READALL_INVALID;
-
-	/* A read error already occurred? */
-	if (ferror(in))
-		return READALL_ERROR;
-
-	while (1) {
-		if (used + READALL_CHUNK + 1 > size) {
-			size = used + READALL_CHUNK + 1;
-
-			/* Overflow check. Some ANSI C compilers
-			   may optimize this away, though. */
-			if (size <= used) {
-				free(data);
-				return READALL_TOOMUCH;
-			}
-
-			temp = realloc(data, size);
-			if (temp == NULL) {
-				free(data);
-				return READALL_NOMEM;
-			}
-			data = temp;
-		}
-
-		n = fread(data + used, 1, READALL_CHUNK, in);
-		if (n == 0)
-			break;
-
-		used += n;
-	}
-
-	if (ferror(in)) {
-		free(data);
-		return READALL_ERROR;
-	}
-
-	temp = realloc(data, used + 1);
-	if (temp == NULL) {
-		free(data);
-		return READALL_NOMEM;
-	}
-	data = temp;
-	data[used] = '\0';
-
-	buf->sections[section]._bytes = data;
-	buf->sections[section]._len = used;
-	buf->sections[section]._curptr = data;
-
-	return READALL_OK;
-}
-
 void writecomments(char *filename) {
 	
 }
 
+// Shown at the next render().
 void Message(char *s, ...) {
-	char *buf; 
+	char buf[512];
 	va_list args;
  	va_start (args, s);
-  	vasprintf (&buf, s, args);
+  	vsnprintf (buf, sizeof(buf), s, args);
 	mvwprintw(cmd, 0, 0, "%s", buf);
-	wrefresh(cmd);
+	wnoutrefresh(cmd);
 	va_end (args);
-	free(buf);
 }
 	
 void Unimplemented(char *s) {
@@ -156,16 +78,26 @@ typedef struct {
 	int datamode; // When true, you're sweeping out data until you hit 'd' again.
 	int dmstartoffset;
 	Buffer *buf;
+	Decoder *dec; // For the display; the listing has its own.
 	Labels *labels;
-	BasicBlock *blocks;
+	Cfg *cfg; // NULL until analysis() when the blocks came from the database
+	int *leaders; // for analysis()
+	int nleaders;
+	int nthreads;
+	BasicBlock *blocks; // from cfg, or the database
 	int nblocks;
+	LineIndex *lines; // of blocks
+	View *view; // Formatted lines
+	Xrefs *xrefs; // of blocks
 
 	// DISASM
 	int line;
 	int topline;
 	int bblock; // index of first basic block on our screen.
 	IList *instructions; // Instructions currently in dispad?
-	int *lineAddresses;
+	char *dirty; // Per row of diswin: draw at the next render().
+	int drawntop; // topline when diswin was last drawn
+	int drawnline; // line highlighted then, or -1
 	
 } State;
 
@@ -213,58 +145,40 @@ void hexstandout(int pos, int on) {
 }
 
 
-int ntab = 0;
 void mymvwprint(char *s, int addr, void *d) {
-	int row = (int)(uintptr_t)d;
-	wmove(diswin, row, 0);
+	DumpOut *o = (DumpOut *)d;
+	wmove(diswin, o->row, 0);
 	int l;
 	if ((l = findLabelByAddr(state.labels, addr)) == -1) {
 		wprintw(diswin, "%08x", addr);
-		//ntab--;
+		//o->ntab--;
 	} else {
 		wprintw(diswin, "%18s:", state.labels->labels[l].name);
-		ntab -= 2;
+		o->ntab -= 2;
 	}
-	for(int i=0;i<ntab;i++) wprintw(diswin, "\t");
+	for(int i=0;i<o->ntab;i++) wprintw(diswin, "\t");
 	wprintw(diswin, "%s", s);
 }	
 
-int filldisline(Buffer *bin, int addr, int row, BasicBlock *blocks, int nblocks, Labels *labels) {
-	// find the basic block containing addr, disassemble it until we get to addr
-	int bb = findAddr(addr, blocks, nblocks);
-	Instruction inst;
-
-	if (blocks[bb].isdata) {
-		ntab = 2;
-		int rval = datadump(bin, blocks[bb].begin, blocks[bb].end, mymvwprint, (void*)(uintptr_t)(row), row+state.topline - blocks[bb].lineno);
-		return rval;	
-	} 
+// Draws listing line state.topline+row, formatted by the view.
+void filldisline(int row) {
+	ViewLine *vl = viewLine(state.view, state.topline + row);
+	if (vl == NULL)
+		return; // Past the end of the listing.
+	if (vl->isdata) {
+		DumpOut o = {.row = row, .ntab = 2};
+		mymvwprint(vl->text, vl->addr, &o);
+		return;
+	}
 	int l;
-	for(int a = blocks[bb].begin; a < blocks[bb].end; ) {
-		disasmone(bin, a, &inst, labels);
-		if (inst.address == addr) {
-			if ((l = findLabelByAddr(labels, addr)) != -1) {
-				mvwprintw(diswin, row, 0, "%08x", addr);
-				mvwprintw(diswin, row, 20 - strlen(labels->labels[l].name) - 2 , "%s: ", labels->labels[l].name);
-			} else {
-				mvwprintw(diswin, row, 0, "%08x ", addr);
-			}
-
-			mvwprintw(diswin, row, 20, "%s", inst.asm);
-			int nextaddr = addr + inst.nbytes;
-			if (nextaddr > blocks[bb].end) { // Past the end of this block.
-				if (2*(bb+1) < nblocks) {
-					nextaddr = blocks[bb+1].begin; // In the next block.
-				} else {
-					nextaddr = -2; // Past the end of basic blocks
-				}
-			}
-			return nextaddr;
-		} else {
-			a += inst.nbytes;
-		}
+	Labels *labels = state.labels;
+	if ((l = findLabelByAddr(labels, vl->addr)) != -1) {
+		mvwprintw(diswin, row, 0, "%08x", vl->addr);
+		mvwprintw(diswin, row, 20 - strlen(labels->labels[l].name) - 2 , "%s: ", labels->labels[l].name);
+	} else {
+		mvwprintw(diswin, row, 0, "%08x ", vl->addr);
 	}
-	return -1; // We're probably in a data segment...
+	mvwprintw(diswin, row, 20, "%s", vl->text);
 }
 
 void hexmoveselection(int oldpos, int pos) {
@@ -305,118 +219,122 @@ void hexmoveselection(int oldpos, int pos) {
 	hexblink(pos, 1);
 	wmove(hex, r,c);
 
-	wrefresh(hex);
+	wnoutrefresh(hex);
 }
 
-void styleline(int line, int on, int attr) {
-	int nrows, ncols;
-	getmaxyx(diswin, nrows, ncols);
-	(void)nrows;
+void styleline(int line, attr_t attr) {
 	int r = line - state.topline;
-	if (r > LINES-1 || r < 0) return;
-	for (int c = 0; c < ncols; c++) {
-		chtype ch0 = mvwinch(diswin, r, c);
-		if (on) {
-			mvwaddch(diswin, r, c, ch0 | attr);
-		} else {
-			mvwaddch(diswin, r, c, ch0 & ~attr);
-		}
+	if (r >= getmaxy(diswin) || r < 0) return;
+	mvwchgat(diswin, r, 0, -1, attr, 0, NULL);
+}
+
+// Rows r0 up to r1 of diswin must be drawn again.
+void damage(int r0, int r1) {
+	for(int r = r0 < 0 ? 0 : r0; r < r1 && r < getmaxy(diswin); r++)
+		state.dirty[r] = 1;
+}
+
+void refilldis(void) {
+	damage(0, getmaxy(diswin));
+}
+
+// Rows showing addr, or an operand naming it, must be drawn again.
+void damagelabel(int addr) {
+	for(int r = 0; r < getmaxy(diswin); r++) {
+		ViewLine *vl = viewLine(state.view, state.topline + r);
+		if (vl != NULL && (vl->addr == addr || vl->refs[0] == addr || vl->refs[1] == addr))
+			state.dirty[r] = 1;
 	}
 }
 
-void refilldis(Buffer *bin, int addr, BasicBlock *blocks, int nblocks, Labels *labels) {
-	wclear(diswin);
-	int nextaddr = addr;
-	for(int r=0; r<LINES-1;r++) {
-		state.lineAddresses[r] = nextaddr;
-		nextaddr = filldisline(bin, nextaddr, r, blocks, nblocks, labels);
-		assert(nextaddr != -1);
-		assert(nextaddr != -2);
+/*
+	Brings diswin up to date with state.topline and state.line, then the
+	terminal with every window, in one update.  Rows already drawn are
+	scrolled into place, so only new or damaged rows are drawn, and moving
+	the selection changes just the attributes of two rows.
+*/
+void render(void) {
+	int hy = getmaxy(diswin);
+	int delta = state.topline - state.drawntop;
+	if (delta <= -hy || delta >= hy) {
+		damage(0, hy);
+	} else if (delta != 0) {
+		scrollok(diswin, 1);
+		wscrl(diswin, delta);
+		scrollok(diswin, 0);
+		if (delta > 0) {
+			memmove(state.dirty, state.dirty + delta, hy - delta);
+			damage(hy - delta, hy);
+		} else {
+			memmove(state.dirty - delta, state.dirty, hy + delta);
+			damage(0, -delta);
+		}
+	}
+	state.drawntop = state.topline;
+	for(int r = 0; r < hy; r++) {
+		if (!state.dirty[r]) continue;
+		wmove(diswin, r, 0);
+		wclrtoeol(diswin);
+		filldisline(r);
+		state.dirty[r] = 0;
+		if (state.topline + r == state.drawnline)
+			state.drawnline = -1; // Drawn plain.
 	}
+	if (state.drawnline != state.line) {
+		styleline(state.drawnline, A_NORMAL);
+		styleline(state.line, A_STANDOUT);
+		state.drawnline = state.line;
+	}
+	wnoutrefresh(diswin);
+	doupdate();
 }
 
-// Make sure state->line is both disassembled and on screen.
+// Make sure state->line is on screen, centring it if it is not.
 void showLine(State *state, int iline) {
 	int line = iline - state->topline;
-	int hy, hx;
-	getmaxyx(diswin, hy, hx); // Macro.
+	int hy = getmaxy(diswin);
 	if (line > hy || line < 0) {
-		wclear(diswin);
 		state->line = iline;
 		state->topline = iline - hy/2;
 		if (state->topline < 0) state->topline = 0;
-		refilldis(state->buf, linetoaddr(state->buf, state->blocks, state->nblocks, state->topline), state->blocks, state->nblocks, state->labels);
-		wrefresh(diswin);
 	} 
 }
 
-int offsetToLine(State *state, int offset) {
-	int bb = findAddr(offset, state->blocks, state->nblocks);
-	int lineno = state->blocks[bb].lineno;
-	if (state->blocks[bb].isdata) {
-		for(int i=state->blocks[bb].begin; i < state->blocks[bb].end; i++) {
-			if (i == offset) return lineno;
-			if ((i % 16) == 0) lineno++;
-		}
-		return lineno;
-	}
-	int addr;
-	for (addr = state->blocks[bb].begin; addr < state->blocks[bb].end; ) {
-		if (addr >= offset) return lineno;
-		Instruction inst;
-		disasmone(state->buf, addr, &inst, state->labels);
-		addr += inst.nbytes;
-		lineno++;	
-	}
-	if (addr >= offset) return lineno;
-	return -1;
+// Selects line, scrolling just far enough to show it.
+void dismoveselection(int line) {
+	int hy = getmaxy(diswin);
+	if (line < state.topline)
+		state.topline = line;
+	else if (line >= state.topline + hy)
+		state.topline = line - hy + 1;
+	state.line = line;
 }
 
-// oldline and line are in absolue coordinates; window top is in state.topline
-void dismoveselection(Buffer *bin, BasicBlock *blocks, int nblocks, Labels *labels, int oldline, int line) {
-	// remove highlight from old line.
-	int r = oldline - state.topline;
-	styleline(oldline, 0, A_STANDOUT);
 
-	int hy, hx;
-	getmaxyx(diswin, hy, hx); // Macro.
-
-	int addr = linetoaddr(bin, blocks, nblocks, line);
-
-	
-	// Scroll if needed.  
-	r = line - state.topline;
-	if (r < 0) {
-		int nlines = -r ;
-		scrollok(diswin, 1);
-		wscrl(diswin, -nlines);
-		scrollok(diswin, 0);
-		state.topline -= nlines;
-		if (nlines > hy) nlines = hy;
-		for( int i = 0; i < nlines; i++) {
-			state.lineAddresses[i] = addr;
-			addr = filldisline(bin, addr, i, blocks, nblocks, labels);
-		}
-	} else if (r >= hy) { // r is the offset to the new line from topline.
-		int nlines = r - hy + 1; 
-		scrollok(diswin, 1);
-		wscrl(diswin, nlines);
-		scrollok(diswin, 0);
-		state.topline += nlines;
-		for( int i = 0; i < nlines; i++) {
-			state.lineAddresses[(hy-nlines) + i] = addr;
-			addr = filldisline(bin, addr, (hy-nlines) + i, blocks, nblocks, labels);
-		}
+// The analysis to edit.  A database holds the blocks, but not the rest of
+// the analysis: that is made again the first time it is edited.
+Cfg *analysis(void) {
+	if (state.cfg == NULL) {
+		state.cfg = newCfg(state.buf, state.leaders, state.nleaders, state.nthreads);
+		STATPHASE(NULL);
 	}
-
-	styleline(line, 1, A_STANDOUT);
-
-	wrefresh(diswin);
+	return state.cfg;
 }
 
+// Picks up the blocks after an edit to the analysis, and redraws.
+void reanalysed(void) {
+	state.blocks = cfgBlocks(state.cfg, &state.nblocks);
+	freeLineIndex(state.lines);
+	state.lines = newLineIndex(state.buf, state.blocks, state.nblocks);
+	viewSetLines(state.view, state.lines);
+	freeXrefs(state.xrefs);
+	state.xrefs = newXrefs(state.buf, state.blocks, state.nblocks);
+	refilldis();
+}
 
 void markasdata(int begin, int end) {
-	Unimplemented("markasdata");
+	cfgMarkData(analysis(), begin, end, state.labels);
+	reanalysed();
 }
 
 void writelabels(char * labelsname) {
@@ -434,12 +352,34 @@ int search(char *s) {
 	sscanf(s, "%127s", str);
 	if (str[0] == 0) return -1;
 	
-	// Lazy initial search, just find a label; later also find uses
+	// Lazy initial search, just find a label; :r lists its uses
 	int idx = findLabelByName(state.labels, str);
-	if (idx < 0) return -1;
+	if (idx < 0) {
+		// Not a whole name: take the first label it starts.
+		int n;
+		idx = findLabelByPrefix(state.labels, str, &n);
+		if (idx < 0) return -1;
+		if (n > 1) Message("%d labels start with %s", n, str);
+	}
 	return state.labels->labels[idx].addr;
 }
 
+// Lists refs on the command line, as many as fit.
+void showrefs(char *what, int addr, Xref *refs, int n, int to) {
+	char buf[512];
+	int len = snprintf(buf, sizeof(buf), "%d refs %s %06x:", n, what, addr);
+	for(int i = 0; i < n && len < COLS && len < (int)sizeof(buf); i++) {
+		int a = to ? refs[i].from : refs[i].to;
+		int l = findLabelByAddr(state.labels, a);
+		if (l != -1)
+			len += snprintf(buf+len, sizeof(buf)-len, " %s %s", state.labels->labels[l].name, xrefkinds[refs[i].kind]);
+		else
+			len += snprintf(buf+len, sizeof(buf)-len, " %06x %s", a, xrefkinds[refs[i].kind]);
+	}
+	werase(cmd);
+	Message("%s", buf);
+}
+
 int exec(char *s) {
 	// This should really be a little language, like ed.
 	// <range><cmd>/<param>/  
@@ -459,10 +399,52 @@ int exec(char *s) {
 
 	switch(ch) {
 	case 'n':
+		damagelabel(addr);
 		addLabel(state.labels, str, addr, 0);
-		wclear(diswin);
-		refilldis(state.buf, linetoaddr(state.buf, state.blocks, state.nblocks, state.topline), state.blocks, state.nblocks, state.labels);
-		wrefresh(diswin);
+		viewLabelChanged(state.view, addr);
+		break;
+	case 'l': // Code starts here.
+		if (cfgAddLeader(analysis(), addr, state.labels) < 0) {
+			Message("%06x is not mapped", addr);
+			break;
+		}
+		reanalysed();
+		break;
+	case 'm': // Mark data, up to the address given.
+		{
+		unsigned int end;
+		if (sscanf(str, "%x", &end) != 1 || end <= addr) {
+			Message("Usage: <begin>m<end>");
+			break;
+		}
+		markasdata(addr, end);
+		}
+		break;
+	case 'u':
+		if (cfgUndo(analysis(), state.labels) < 0) {
+			Message("Nothing to undo");
+			break;
+		}
+		reanalysed();
+		break;
+	case 'r': // Who references here
+		{
+		Xref *refs;
+		int n = xrefsTo(state.xrefs, addr, addr+1, &refs);
+		showrefs("to", addr, refs, n, 1);
+		}
+		break;
+	case 'R': // What the block here references
+		{
+		int bb = findBlockByAddr(state.lines, addr);
+		if (bb == state.nblocks || addr < state.blocks[bb].begin || state.blocks[bb].isdata) {
+			Message("%06x is not code", addr);
+			break;
+		}
+		Xref *refs;
+		int n = xrefsFrom(state.xrefs, state.blocks[bb].begin, state.blocks[bb].end, &refs);
+		showrefs("from", state.blocks[bb].begin, refs, n, 0);
+		}
 		break;
 	case 'p':
 		if (str[0] == 0) {
@@ -478,18 +460,30 @@ int exec(char *s) {
 }
 
 
+// Whether a key is waiting to be read.
+int keywaiting(void) {
+	nodelay(stdscr, TRUE);
+	int ch = getch();
+	nodelay(stdscr, FALSE);
+	if (ch == ERR) return 0;
+	ungetch(ch);
+	return 1;
+}
+
 enum EditMode {
 	HEXEDITOR = 0,
 	DISASMEDITOR
 };
 
-void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
+// The analysis is in state.blocks, lines and xrefs.
+void interact(Buffer *buf, Labels *labels) {
 	state.buf = buf;
+	state.dec = newDecoder(buf);
 	state.labels = labels;
 	state.line = 0;
 	state.topline = 0;
-	state.blocks = blocks;
-	state.nblocks = nblocks;
+	int nblocks = state.nblocks;
+	BasicBlock *blocks = state.blocks;
 
 	enum EditMode editmode = HEXEDITOR;
 	initscr();			/* Start curses mode 		  */
@@ -503,8 +497,7 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 	refresh();
 
 	// Must happen after ncurses setup.
-	state.lineAddresses = malloc(sizeof(int) * (LINES-1));
-	memset(state.lineAddresses, 0, sizeof(int)*(LINES-1));
+	state.view = newView(state.dec, state.lines, labels, LINES-1);
 
 	// 01234567: 0123 4567  0123 4567  0123 4567  0123 4567 
 #if HEXON
@@ -529,23 +522,29 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 	cmd = newwin(1, COLS, LINES-1, 0);
 
 	scrollok(diswin, 0);
+	idlok(diswin, TRUE); // Let the terminal do render()'s scrolling.
 
-	refilldis(buf, state.lineAddresses[0], blocks, nblocks, labels);
-	wrefresh(diswin);
+	state.dirty = malloc(getmaxy(diswin));
+	state.drawntop = 0;
+	state.drawnline = -1;
+	refilldis();
 	wprintw(cmd, "read %d bytes", bufferLen(buf));
 	wmove(cmd, 0, 0);
-	wrefresh(cmd);
+	wnoutrefresh(cmd);
 
 	// Show the disassembly
-	dismoveselection(buf, blocks, nblocks, labels, state.line, state.line);
+	dismoveselection(state.line);
 
 	int repeats = 0;
 	int hascount = 0;
 	int oldoffset = 0;
 	int hexmode = 0;
-	int oldline = 0;
 
 	while (1) {
+		// Draw once the keys typed ahead have all been handled.
+		if (!keywaiting())
+			render();
+		STATPHASE(NULL);
 		char ch = getch();
 
 		char cbuf[512];
@@ -599,8 +598,10 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 				mvwaddch(cmd, 0,0, ':');
 				mvwgetnstr(cmd, 0,1, buf, 128);
 				noecho();
+				Message("Command: %s", buf); // Before any message of its own.
 				if (exec(buf)) return;
-				Message("Command: %s", buf);
+				blocks = state.blocks; // An edit may have rebuilt them.
+				nblocks = state.nblocks;
 				}
 				break;
 		case '/': // Search for label
@@ -617,26 +618,18 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 					break;
 				}
 				repeats = addr;
-				wclear(cmd);
-				wrefresh(cmd);
+				werase(cmd);
+				wnoutrefresh(cmd);
 				}
 				/* FALLTHROUGH */
 		case 'g':
-				oldline = state.line;
 				oldoffset = state.offset;
 				state.offset = repeats;
 				if (state.offset > bufferLen(state.buf)) state.offset = bufferLen(state.buf);
 				hexmoveselection(oldoffset, state.offset);
-				int line = offsetToLine(&state, state.offset);
-				int r = line - state.topline;
-				if (r >= 0 && r < LINES-1) {
-					state.line = line;
-					dismoveselection(buf, blocks, nblocks, labels, oldline, state.line);
-				} else {
-					showLine(&state, line);
-					state.line = line;
-					dismoveselection(buf, blocks, nblocks, labels, state.line, state.line);
-				}
+				int line = addrtoline(state.lines, state.offset);
+				showLine(&state, line);
+				dismoveselection(line);
 				break;
 
 		default:
@@ -646,7 +639,6 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 		if (editmode == HEXEDITOR) {
 		switch(ch) {
 		case 'd':
-				Unimplemented("Data mode");
 				if (state.datamode != 0) { // Exiting datamode.
 					if (state.offset < state.dmstartoffset) {
 						markasdata(state.offset, state.dmstartoffset);
@@ -702,37 +694,40 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 		} else if (editmode == DISASMEDITOR) {
 		switch(ch) {
 		case 0x07: //^g
-				Message("On line %d\n", state.line);
+				{
+				long hits, misses, entries;
+				icacheStats(buf->icache, &hits, &misses, &entries);
+				hits += state.dec->hits;
+				misses += state.dec->misses;
+				Message("On line %d; icache %ld hits, %ld misses, %ld entries\n", state.line, hits, misses, entries);
+				}
 				break;
 		case 'r': // refresh
-				wclear(diswin);
-				refilldis(buf, linetoaddr(state.buf, state.blocks, state.nblocks, state.topline), blocks, nblocks, labels);
-				wrefresh(diswin);
+				clearok(curscr, TRUE); // Repaint the whole terminal.
+				refilldis();
 				break;
 
 		case 0x06:  //^f
 				repeats *= LINES/2;
 				// fallthrough
 		case 'j':
-				oldline = state.line;
 				state.line+=repeats;
 				if (state.line >= (blocks[nblocks-1].lineno + blocks[nblocks-1].ninstr)) 
 					state.line = blocks[nblocks-1].lineno + blocks[nblocks-1].ninstr;
-				dismoveselection(buf, blocks, nblocks, labels, oldline, state.line);
+				dismoveselection(state.line);
 				oldoffset = state.offset;
-				state.offset = state.lineAddresses[state.line-state.topline];
+				state.offset = linetoaddr(state.lines, state.line);
 				hexmoveselection(oldoffset, state.offset);
 				break;
 		case 0x02:  //^b
 				repeats *= LINES/2;
 				// fallthrough
 		case 'k':
-				oldline = state.line;
 				state.line-=repeats;
 				if (state.line < 0) state.line = 0;
-				dismoveselection(buf, blocks, nblocks, labels, oldline, state.line);
+				dismoveselection(state.line);
 				oldoffset = state.offset;
-				state.offset = state.lineAddresses[state.line-state.topline];
+				state.offset = linetoaddr(state.lines, state.line);
 				hexmoveselection(oldoffset, state.offset);
 				break;
 		}
@@ -745,26 +740,6 @@ void interact(Buffer *buf, Labels *labels, BasicBlock *blocks, int nblocks) {
 
 }
 
-// Only generate labels if there isn't already a label for that address.
-// Add them as auto-generated so they don't get saved and restored.
-void generateLabels(Labels *l, BasicBlock *blocks, int nblocks) {
-	for(int i = 0; i < nblocks; i++) {
-		if (findLabelByAddr(l, blocks[i].begin) == -1) {
-			char buf[128];
-			sprintf(buf, "L%06x", blocks[i].begin);
-			addLabel(l, buf, blocks[i].begin, 1);
-		}
-	}
-}
-
-void myfprint(char *s, int addr, void *d) {
-	FILE *fp = (FILE *)d;
-	fprintf(fp, "%06x", addr);
-	for(int i=0;i<ntab;i++) fprintf(fp,"\t");
-	fprintf(fp, "%s", s);
-	ntab = 4; // Cheesy "use fewer tabs on each start"
-}
-
 jmp_buf bailout;
 
 int main(int argc, char **argv)
@@ -773,14 +748,32 @@ int main(int argc, char **argv)
 	int opt;
 	int isboot=0;
 	int interactive=0;
-	while ((opt = getopt(argc, argv, "bi")) != -1) {
+	int nthreads=0; // One per processor
+	int showstats=0;
+	static struct option longopts[] = {
+		{"stats", no_argument, NULL, 's'},
+		{NULL, 0, NULL, 0},
+	};
+	while ((opt = getopt_long(argc, argv, "bcij:", longopts, NULL)) != -1) {
 		switch(opt) {
+		case 'c':
+			exit(checkoptable() ? 1 : 0);
 		case 'b':
 			isboot = true;
 			break;
 		case 'i':
 			interactive = true;
 			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+#ifdef PRINT_STATS
+			showstats = true;
+#else
+			fprintf(stderr, "--stats needs a build with PRINT_STATS defined\n");
+#endif
+			break;
 		}
 	}
 	if (optind < argc) {
@@ -791,7 +784,9 @@ int main(int argc, char **argv)
 	asprintf(&labelsname,"%s.lbls", inbase);
 	asprintf(&disasmname, "%s.lst", inbase);
 	asprintf(&commentsname, "%s.ann", inbase);
+	asprintf(&adbname, "%s.adb", inbase);
 	//kill(getpid(), SIGSTOP);
+	STATPHASE("load");
 	Labels *labels = newLabels(1);
 	state.labels = labels;
 	FILE *fp = fopen(labelsname, "r");
@@ -805,24 +800,18 @@ int main(int argc, char **argv)
 	bufferAddSection(buf, 0, 0x20000, "RAM");
 	bufferAddSection(buf, 0xf00000, 0x20000, "ROM");
 
-	// Read our file
-	fp = fopen("waldorfwave-boot.BIN", "r");
-	if (fp == NULL) {
+	// Map our files
+	if (bufferMapFile(buf, "ROM", 0xf00000, "waldorfwave-boot.BIN") < 0) {
 		fprintf(stderr, "Could not open file\n");
 		exit(-1);
 	}
-	readall(fp, buf, 0xf00000, "ROM");
-	fclose(fp);
-
-	fp = fopen("W2SYS.BIN", "r");
-	if (fp == NULL) {
+	if (bufferMapFile(buf, "RAM", 0x1000, "W2SYS.BIN") < 0) { // base at 0x1000, section 0
 		fprintf(stderr, "Could not open file\n");
 		exit(-1);
 	}
-	readall(fp, buf, 0x1000, "RAM"); // base at 0x1000, section 0
-	fclose(fp);
-	bufferSeek(buf, 0);
+	buf->icache = newICache(buf); // Shared by the listing and the display.
 
+	STATPHASE("leaders");
 	int *leaders = NULL;
 	int nleaders = 0;
 	fp = fopen("leaders.txt", "r");
@@ -848,50 +837,60 @@ int main(int argc, char **argv)
 	}
  
 
-	// Calculate basic blocks
-	BasicBlock *blocks=0;
-	int nblocks, *invalid, ninvalid;
-	findBasicBlocks(buf, leaders, nleaders, &blocks, &nblocks, &invalid, &ninvalid);
-	generateLabels(labels, blocks, nblocks);
-	
-	FILE *outfile = fopen(disasmname, "w");
-	Instruction instr;
-	int l;
-	for(int i = 0; i < nblocks; i++) {
-		char str[128];
-		//sprintf(str, "\t# Block %d:%06x-%06x: line %d", i, blocks[i].begin, blocks[i].end, blocks[i].lineno); 
-		for(int addr = blocks[i].begin; addr < blocks[i].end; ) {
-			if ((l = findLabelByAddr(labels, addr)) != -1) {
-//				fprintf(outfile, "%08x", addr);
-				fprintf(outfile, "%16s: ", labels->labels[l].name);
-			} else {
-				fprintf(outfile, "%08x\t", addr);
-			}
-			if (blocks[i].isdata) {
-				if (addr == blocks[i].begin) ntab = 2;
-				datadump(buf, blocks[i].begin, blocks[i].end, myfprint, outfile, -1);
-				addr = blocks[i].end;
-				continue;
-			}
-			disasmone(buf, addr, &instr, state.labels);
-			fprintf(outfile, "\t\t%s%s\n", instr.asm, str);
-			str[0] = 0;
-			addr += instr.nbytes;
-		}
+	// Calculate basic blocks, unless the database has them already.
+	STATPHASE("database");
+	uint64_t hash[NADBINPUTS];
+	hash[ADBPROGRAM] = hashfile("W2SYS.BIN");
+	hash[ADBBOOT] = hashfile("waldorfwave-boot.BIN");
+	hash[ADBLEADERS] = hashfile("leaders.txt");
+	hash[ADBLABELS] = hashfile(labelsname);
+	int labelsok = 0;
+	Adb *db = openAdb(adbname, buf, hash, &labelsok);
+	state.leaders = leaders;
+	state.nleaders = nleaders;
+	state.nthreads = nthreads;
+	if (db != NULL) {
+		state.blocks = db->blocks;
+		state.nblocks = db->nblocks;
+		state.lines = &db->lines;
+		state.xrefs = &db->xrefs;
+	} else {
+		state.cfg = newCfg(buf, leaders, nleaders, nthreads);
+		state.blocks = cfgBlocks(state.cfg, &state.nblocks);
+		STATPHASE("lineindex");
+		state.lines = newLineIndex(buf, state.blocks, state.nblocks);
+		STATPHASE("xrefs");
+		state.xrefs = newXrefs(buf, state.blocks, state.nblocks);
+	}
+	STATPHASE("generateLabels");
+	generateLabels(labels, state.blocks, state.nblocks);
+
+	// The listing only changes with the analysis or the labels.
+	STATPHASE("listing");
+	if (db == NULL || !labelsok || access(disasmname, F_OK) != 0) {
+		FILE *outfile = fopen(disasmname, "w");
+		writelisting(outfile, buf, state.blocks, state.nblocks, labels, nthreads);
+		fclose(outfile);
+	}
+	STATPHASE("save");
+	if ((db == NULL || !labelsok) && saveAdb(adbname, hash, state.blocks, state.nblocks, state.lines, state.xrefs) < 0)
+		fprintf(stderr, "Could not save %s: %s\n", adbname, strerror(errno));
+
+	STATPHASE(NULL);
+	if (!interactive) {
+		if (showstats) STATREPORT(stderr);
+		return 0;
 	}
-	fclose(outfile);
-
-	if (!interactive) return 0;
-	
-	bufferSeek(buf, 0);
 
+	STATPHASE("ui"); // Until the first screen is drawn
 	if (!setjmp(bailout))
-		interact(buf, labels, blocks, nblocks);
+		interact(buf, labels);
 
 	writelabels(labelsname);
 	writecomments(commentsname);
 
 	endwin();			/* End curses mode		  */
+	if (showstats) STATREPORT(stderr);
 	return 0;
 }
 
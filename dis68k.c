@@ -8,6 +8,7 @@
 	onward: 	see Git history. */
 
 
+#define _POSIX_C_SOURCE 200809L // strdup
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -15,13 +16,27 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 #include "dat.h"
 
-static uint32_t address, romstart;
-bool rawmode = false;
-
 void gBufprintf(char *s, ...) {}
 
+Decoder *newDecoder(Buffer *bin) {
+	Decoder *d = malloc(sizeof(Decoder));
+	d->bin = bin;
+	d->sec = NULL;
+	d->address = 0;
+	d->romstart = 0;
+	d->rawmode = false;
+	d->hits = d->misses = 0;
+	return d;
+}
+
+void freeDecoder(Decoder *d) {
+	if (d->bin->icache != NULL) icacheCount(d->bin->icache, d->hits, d->misses);
+	free(d);
+}
+
 
 // Enable the #define below to print diagnostics.
 //#define PRINT_DIAGNOSTICS
@@ -87,13 +102,14 @@ const char scc_tab[][4] = {
 const char size_arr[3] = {'B','W','L'};
 
 /*!
-	Reads from @c filename and populates the global variable @c map.
+	Reads from @c filename and populates the global variable @c map, and
+	the @c romstart of @c d.
 	If @c filename is @c NULL, populates @c map with the empty map.
 
 	@returns @c false if a filename is specified but could not be opened
 		or else could not properly be parsed. @c true otherwise.
 */
-bool readmap(const char *filename) {
+bool readmap(Decoder *d, const char *filename) {
 	FILE *fmap;
 
 	// Create a sixteen-item map, to be getting on with.
@@ -106,13 +122,13 @@ bool readmap(const char *filename) {
 			return false;
 		}
 
-		romstart = 0;
+		d->romstart = 0;
 		map[0].start = 0L;
 		map[0].end = 0xffffffff;
 		map[0].type = Code;
 		map[1].type = End;
 	} else {
-		if (!fscanf(fmap,"romstart = %X", &romstart)) {
+		if (!fscanf(fmap,"romstart = %X", &d->romstart)) {
 			fprintf(stderr, "Error in romstart = line!\n");
 			return false;
 		}
@@ -164,1101 +180,1313 @@ bool readmap(const char *filename) {
 	return true;
 }
 
+// Does section s hold the n bytes at addr?
+static inline bool inSection(Section *s, uint32_t addr, int n) {
+	return s != NULL && addr >= (uint32_t)s->_baseaddress && addr - s->_baseaddress + n <= s->_len;
+}
+
+/*!
+	Returns a pointer to the @c n bytes at @c addr if one section holds them
+	all, else @c NULL.  The section is remembered in @c d, so a run of
+	fetches from one section costs a range check each.
+*/
+static inline const unsigned char *fetchptr(Decoder *d, uint32_t addr, int n) {
+	if (!inSection(d->sec, addr, n)) {
+		const int s = bufferSectionByAddr(d->bin, addr);
+		if (s < 0) return NULL;
+		d->sec = &d->bin->sections[s];
+		if (!inSection(d->sec, addr, n)) return NULL;
+	}
+	return d->sec->_bytes + (addr - d->sec->_baseaddress);
+}
+
 /*!
-	Gets and echoes the next byte from stdin and increments the global @c address;
-	if stdin is exhausted, prints an error and causes the program to exit with
-	code EXIT_FAILURE.
+	Gets the next byte from the buffer and increments the @c address of @c d;
+	if the buffer is exhausted, prints an error and causes the program to exit
+	with code EXIT_FAILURE.
 */
-unsigned int getbyte(Buffer *b) {
-	const int byte = bufferGetCh(b);
-	if (bufferIsEOF(b, address)) {
+unsigned int getbyte(Decoder *d) {
+	STAT(fetches);
+	const unsigned char *p = fetchptr(d, d->address, 1);
+	if (p) {
+		++ d->address;
+		return *p;
+	}
+	const int byte = 0; // No section holds it: unmapped, or past the end.
+	if (bufferIsEOF(d->bin, d->address)) {
 		fprintf(stderr, "Unexpected end of input\n");
 		exit(EXIT_FAILURE);
 	}
-	++ address;
+	++ d->address;
 	//gBufprintf("%02x ", byte);
 	return byte;
 }
 
 /*!
-	Gets and echoes the next word from stdin and increments the global @c address twice;
-	if stdin is exhausted, prints an error and causes the program to exit with
-	code EXIT_FAILURE.
+	Gets the next word from the buffer and increments the @c address of @c d twice;
+	if the buffer is exhausted, prints an error and causes the program to exit
+	with code EXIT_FAILURE.
 */
-int getword(Buffer *b) {
-	int word = bufferGetCh(b) << 8;
-	word |= bufferGetCh(b);
+int getword(Decoder *d) {
+	STAT(fetches);
+	const unsigned char *p = fetchptr(d, d->address, 2);
+	int word;
+	if (p) {
+		word = (p[0] << 8) | p[1];
+	} else {
+		// Unmapped, or straddling a section boundary.
+		word = bufferRead(d->bin, d->address) << 8;
+		word |= bufferRead(d->bin, d->address + 1);
 
-	if (bufferIsEOF(b, address)) {
-		fprintf(stderr, "Unexpected end of input\n");
-		exit(EXIT_FAILURE);
+		if (bufferIsEOF(d->bin, d->address)) {
+			fprintf(stderr, "Unexpected end of input\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	address += 2;
-	if (!rawmode) {
+	d->address += 2;
+	if (!d->rawmode) {
 //		gBufprintf("%04x ", word);
 	}
 	return word;
 }
 
 /*!
-	Prints the addressing mode @c mode, using @c reg and @c size, to @c out_s.
+	Decodes the addressing mode from @c instruction.
+
+	@returns A mode in the range 0 to 11, if a valid addressing mode could be
+		determined; 12 otherwise.
+*/
+int getmode(int instruction) {
+	const int mode = (instruction & 0x0038) >> 3;
+	const int reg = instruction & 0x0007;
+
+	if (mode == 7) {
+		if (reg >= 5) {
+			return 12; /* i.e. invalid */
+		} else {
+			return 7 + reg;
+		}
+	}
+	return mode;
+}
+
+/*
+	Decode table.  For each of the 65536 possible first words, opclass[] holds
+	an index into opcands[], a zero-terminated list of the optab entries whose
+	and/xor mask matches that word, in optab order.  No word matches more than
+	three entries, and there are only ~130 distinct lists.  Class 0 is the empty
+	list: no entry matches and the word is invalid.
+*/
+#define MAXCANDS 4
+static uint8_t opclass[65536];
+static uint8_t opcands[256][MAXCANDS];
+static int nopclasses;
+static pthread_once_t optableonce = PTHREAD_ONCE_INIT; // Decoders on several threads may race to build it.
+
+// The candidate list from a linear scan of optab; returns the number found.
+static int scanoptab(int word, uint8_t *cands) {
+	int n = 0;
+	memset(cands, 0, MAXCANDS);
+	for (int opnum = 1; opnum <= 87; ++opnum) {
+		if ((word & optab[opnum].and) == optab[opnum].xor) {
+			if (n == MAXCANDS - 1) panic("optab: too many candidates for %04x\n", word);
+			cands[n++] = opnum;
+		}
+	}
+	return n;
+}
+
+void buildoptable(void) {
+	nopclasses = 1; // opcands[0] is the empty list.
+	memset(opcands[0], 0, MAXCANDS);
+	for (int word = 0; word < 65536; word++) {
+		uint8_t cands[MAXCANDS];
+		int c;
+		scanoptab(word, cands);
+		for (c = 0; c < nopclasses; c++)
+			if (memcmp(opcands[c], cands, MAXCANDS) == 0) break;
+		if (c == nopclasses) {
+			if (nopclasses == 256) panic("optab: too many opcode classes\n");
+			memcpy(opcands[nopclasses++], cands, MAXCANDS);
+		}
+		opclass[word] = c;
+	}
+}
+
+/*!
+	Compares the decode table against a linear optab scan for every first word.
+
+	@returns the number of words whose candidate lists differ.
+*/
+int checkoptable(void) {
+	int bad = 0;
+	pthread_once(&optableonce, buildoptable);
+	for (int word = 0; word < 65536; word++) {
+		uint8_t cands[MAXCANDS];
+		scanoptab(word, cands);
+		if (memcmp(opcands[opclass[word]], cands, MAXCANDS) != 0) {
+			fprintf(stderr, "optable mismatch at %04x\n", word);
+			bad++;
+		}
+	}
+	fprintf(stderr, "optable: %d classes, %d mismatches\n", nopclasses, bad);
+	return bad;
+}
+
+static const char *mnemonic_tab[NMNEMONICS] = {
+	[M_INVALID] = "???",
+	[M_ABCD] = "ABCD",	[M_ADD] = "ADD",	[M_ADDA] = "ADDA",	[M_ADDI] = "ADDI",
+	[M_ADDQ] = "ADDQ",	[M_ADDX] = "ADDX",	[M_AND] = "AND",	[M_ANDI] = "ANDI",
+	[M_ASL] = "ASL",	[M_ASR] = "ASR",	[M_BCC] = "Bcc",	[M_BCHG] = "BCHG",
+	[M_BCLR] = "BCLR",	[M_BSET] = "BSET",	[M_BTST] = "BTST",	[M_CHK] = "CHK",
+	[M_CLR] = "CLR",	[M_CMP] = "CMP",	[M_CMPA] = "CMPA",	[M_CMPI] = "CMPI",
+	[M_CMPM] = "CMPM",	[M_DBCC] = "DBcc",	[M_DIVS] = "DIVS",	[M_DIVU] = "DIVU",
+	[M_EOR] = "EOR",	[M_EORI] = "EORI",	[M_EXG] = "EXG",	[M_EXT] = "EXT",
+	[M_JMP] = "JMP",	[M_JSR] = "JSR",	[M_LEA] = "LEA",	[M_LINK] = "LINK",
+	[M_LSL] = "LSL",	[M_LSR] = "LSR",	[M_MOVE] = "MOVE",	[M_MOVEA] = "MOVEA",
+	[M_MOVEM] = "MOVEM",	[M_MOVEP] = "MOVEP",	[M_MOVEQ] = "MOVEQ",	[M_MULS] = "MULS",
+	[M_MULU] = "MULU",	[M_NBCD] = "NBCD",	[M_NEG] = "NEG",	[M_NEGX] = "NEGX",
+	[M_NOP] = "NOP",	[M_NOT] = "NOT",	[M_OR] = "OR",		[M_ORI] = "ORI",
+	[M_PEA] = "PEA",	[M_RESET] = "RESET",	[M_ROL] = "ROL",	[M_ROR] = "ROR",
+	[M_ROXL] = "ROXL",	[M_ROXR] = "ROXR",	[M_RTE] = "RTE",	[M_RTR] = "RTR",
+	[M_RTS] = "RTS",	[M_SBCD] = "SBCD",	[M_SCC] = "Scc",	[M_STOP] = "STOP",
+	[M_SUB] = "SUB",	[M_SUBA] = "SUBA",	[M_SUBI] = "SUBI",	[M_SUBQ] = "SUBQ",
+	[M_SUBX] = "SUBX",	[M_SWAP] = "SWAP",	[M_TAS] = "TAS",	[M_TRAP] = "TRAP",
+	[M_TRAPV] = "TRAPV",	[M_TST] = "TST",	[M_UNLK] = "UNLK",
+};
+
+/*!
+	Gets the next extension word and records it in @c in.
+*/
+static int getext(Decoder *d, Instruction *in) {
+	const int word = getword(d);
+	if (in->next < sizeof(in->ext)/sizeof(in->ext[0]))
+		in->ext[in->next++] = word;
+	return word;
+}
+
+// A register operand: modes 0 to 4 carry no extension words.
+static void setreg(Operand *op, int mode, int reg) {
+	op->kind = OPK_EA;
+	op->mode = mode;
+	op->reg = reg;
+}
+
+static void setop(Operand *op, int kind, int value) {
+	op->kind = kind;
+	op->value = value;
+}
+
+/*!
+	Decodes the addressing mode @c mode, using @c reg and @c size, into @c op,
+	fetching any extension words it needs.
 
 	@param mode 0 to 12, indicating addressing mode.
 	@param size 0 = byte, 1 = word, 2 = long.
 */
-void sprintmode(Buffer *gBuf, Labels *lbls, unsigned int mode, unsigned int reg, unsigned int size, char *out_s, int *absaddr) {
-	const char ir[2] = {'W','L'}; /* for mode 6 */
+static void decodeea(Decoder *d, Instruction *in, Operand *op, unsigned int mode, unsigned int reg, unsigned int size) {
+	op->kind = OPK_EA;
+	op->mode = mode;
+	op->reg = reg;
+	op->size = size;
 
 	switch(mode) {
-		case 0  : sprintf(out_s, "D%i", reg);		break;
-		case 1  : sprintf(out_s, "A%i", reg);		break;
-		case 2  : sprintf(out_s, "(A%i)", reg);		break;
-		case 3  : sprintf(out_s, "(A%i)+", reg);	break;
-		case 4  : sprintf(out_s, "-(A%i)", reg);	break;
 		case 5  : /* reg + disp */
 		case 9  : { /* pcr + disp */
-			int32_t displacement = (int32_t) getword(gBuf);
+			int32_t displacement = (int32_t) getext(d, in);
 			if (displacement >= 32768) displacement -= 65536;
-			if (mode == 5) {
-				sprintf(out_s, "%+i(A%i)", displacement, reg);
-			} else {
-				const uint32_t ldata = address - 2 + displacement;
-				char label[MAXLABELLEN+2];
-				int pos;
-				if ((pos = findLabelByAddr(lbls, ldata)) != -1) {
-					sprintf(label, "<%s>", lbls->labels[pos].name);
-				} else label[0] = 0;
-				if (!rawmode) {
-					sprintf(out_s, "%+i(PC) {$%08x%s}", displacement, ldata, label);
-				} else {
-					sprintf(out_s, "%+i(PC)", displacement);
-				}
-				*absaddr = ldata;
+			op->value = displacement;
+			if (mode == 9) {
+				op->absaddr = d->address - 2 + displacement;
+				op->hasabs = 1;
 			}
 		} break;
 		case 6  : /* Areg with index + disp */
-		case 10 : {/* PC with index + disp */
-			const int data = getword(gBuf); /* index and displacement data */
+		case 10 : /* PC with index + disp */
+			op->index = getext(d, in); /* index and displacement data */
+			break;
+		case 7  :
+			op->value = getext(d, in);
+			op->absaddr = op->value;
+			op->hasabs = 1;
+			break;
+		case 8  : {
+			const uint32_t data1 = getext(d, in);
+			const uint32_t data2 = getext(d, in);
+			op->absaddr = op->value = (data1 << 16) | data2;
+			op->hasabs = 1;
+		} break;
+		case 11 : {
+			const uint32_t data1 = getext(d, in);
+			switch(size) {
+				case 0 : op->value = data1 & 0x00FF;
+					break;
+				case 1 : op->value = data1;
+					break;
+				case 2 : op->value = (data1 << 16) | getext(d, in);
+					op->hasabs = 1;
+					break;
+			}
+			op->absaddr = op->value;
+		} break;
+	}
+}
 
-			int displacement = (data & 0x00FF);
-			if (displacement >= 128) displacement -= 256;
+/*!
+	Decodes @c word as optab entry @c opnum into @c in, fetching extension words
+	as needed.  Each case rejects the word before touching @c in, so a failed
+	candidate leaves @c in as it found it.
 
-			const int ireg = (data & 0x7000) >> 12;
-			const int itype = (data & 0x8000); /* == 0 is Dreg */
-			const int isize = (data & 0x0800) >> 11; /* == 0 is .W else .L */
+	@returns @c false if @c word is not a valid @c opnum instruction.
+*/
+static bool decodeop(Decoder *d, int word, int opnum, Instruction *in) {
+	switch(opnum) { /* opnum = 1..87 */
+		case 1  :
+		case 74 : { /* ABCD + SBCD */
+			const int sreg = word & 0x0007;
+			const int dreg = (word & 0x0E00) >> 9;
+			in->soperand = sreg;
+			in->doperand = dreg;
+			in->mnemonic = (opnum == 1) ? M_ABCD : M_SBCD;
+			in->size = NOSIZE;
+			if ((word & 0x0008) == 0) {
+				/* reg-reg */
+				in->src = in->dst = DATA_REG;
+				setreg(&in->op[0], 0, sreg);
+				setreg(&in->op[1], 0, dreg);
+			} else {
+				/* mem-mem */
+				in->src = in->dst = ADDR_REG;
+				in->prepost = PREDECR;
+				setreg(&in->op[0], 4, sreg);
+				setreg(&in->op[1], 4, dreg);
+			}
+			in->nops = 2;
+		} return true;
+		case 2  :
+		case 7  :
+		case 31 :
+		case 59 : /* ADD, AND, EOR, OR */
+		case 77 : { /* SUB */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = (word & 0x00C0) >> 6;
+
+			/* Diagnostic code */
+			diagnostic_gBufprintf("dmode = %i, dreg = %i, size = %i",dmode,dreg,size);
+
+			if (size == 3) break;
+			/*
+			if (dmode == 1) break;
+			*/
+			if ((opnum ==  2) && (dmode == 1) && (size == 0)) break;
+			if ((opnum == 77) && (dmode == 1) && (size == 0)) break;
+
+			const int dir = (word & 0x0100) >> 8; /* 0 = dreg dest */
+			if ((opnum == 31) && (dir == 0)) break;
+			/* dir == 1 : Dreg is source */
+			if ((dir == 1) && (dmode >= 9)) break;
+
+			switch(opnum) {
+				case  2 : in->mnemonic = M_ADD;
+					break;
+				case  7 : in->mnemonic = M_AND;
+					break;
+				case 31 : in->mnemonic = M_EOR;
+					break;
+				case 59 : in->mnemonic = M_OR;
+					break;
+				case 77 : in->mnemonic = M_SUB;
+					break;
+			}
+			in->size = size;
+
+			/* reverse source & dest if dir == 0 */
+			Operand *ea = &in->op[dir != 0 ? 1 : 0];
+			decodeea(d, in, ea, dmode, dreg, size);
+			setreg(&in->op[dir != 0 ? 0 : 1], 0, (word & 0x0E00) >> 9);
+			in->nops = 2;
+		} return true;
+		case 3  :
+		case 78 : { /* ADDA + SUBA */
+			const int smode = getmode(word);
+			const int sreg = word & 0x0007;
+			//const int dreg = (word & 0x0E00) >> 9;
+			const int size = ((word & 0x0100) >> 8) + 1;
+			in->mnemonic = (opnum == 3) ? M_ADDA : M_SUBA;
+			in->size = size;
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			setreg(&in->op[1], 1, sreg);
+			in->nops = 2;
+		} return true;
+		case 4  :
+		case 8  :
+		case 26 :
+		case 32 :
+		case 60 :
+		case 79 : { /* ADDI, ANDI, CMPI, EORI, ORI, SUBI */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = (word & 0x00C0) >> 6;
+
+			if (size == 3) break;
+			if (dmode == 1) break;
+			if ((dmode == 9) || (dmode == 10)) break; /* Invalid */
+			if (dmode == 12) break;
+			if ((dmode == 11) && /* ADDI, CMPI, SUBI */
+				((opnum == 4) || (opnum == 26) || (opnum == 79))) break;
+
+			switch(opnum) {
+				case  4 : in->mnemonic = M_ADDI;
+					break;
+				case  8 : in->mnemonic = M_ANDI;
+					break;
+				case 26 : in->mnemonic = M_CMPI;
+					break;
+				case 32 : in->mnemonic = M_EORI;
+					break;
+				case 60 : in->mnemonic = M_ORI;
+					break;
+				case 79 : in->mnemonic = M_SUBI;
+					break;
+			}
+			in->size = size;
 
-			if (mode == 6) {
-				if (itype == 0) {
-					sprintf(out_s, "%+i(A%i,D%i.%c)", displacement, reg, ireg, ir[isize]);
-				} else {
-					sprintf(out_s, "%+i(A%i,A%i.%c)", displacement, reg, ireg, ir[isize]);
-				}
-			} else { /* PC */
-				if (itype == 0) {
-					sprintf(out_s, "%+i(PC,D%i.%c)", displacement, ireg, ir[isize]);
-				} else {
-					sprintf(out_s, "%+i(PC,A%i.%c)", displacement, ireg, ir[isize]);
-				}
+			uint32_t data = getext(d, in);
+			if (size == 2) data = (data << 16) | getext(d, in);
+			setop(&in->op[0], OPK_IMM, data);
+			in->op[0].size = size;
+
+			if (dmode == 11) {
+				setop(&in->op[1], OPK_SR, 0);
+			} else {
+				decodeea(d, in, &in->op[1], dmode, dreg, size);
 			}
-		} break;
-		case 7  : {
-			const int data1 = getword(gBuf);
-			//sprintf(out_s, "$0000%04x", data1);
-			int l;
-			if ((l = findLabelByAddr(lbls, data1)) != -1) {
-				sprintf(out_s, "$%08x<%s>", data1, lbls->labels[l].name);
+			in->nops = 2;
+		} return true;
+		case 5  :
+		case 80 : {/* ADDQ + SUBQ */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = (word & 0x00C0) >> 6;
+
+			if (size == 3) break;
+			if (dmode >= 9) break;
+			if ((size == 0) && (dmode == 1)) break;
+
+			in->mnemonic = (opnum == 5) ? M_ADDQ : M_SUBQ;
+			in->size = size;
+			const int count = (word & 0x0E00) >> 9;
+			setop(&in->op[0], OPK_QUICK, count ? count : 8);
+			decodeea(d, in, &in->op[1], dmode, dreg, size);
+			in->nops = 2;
+		} return true;
+		case 6  :
+		case 81 : /* ADDX + SUBX */
+		case 27 : { /* CMPM */
+			const int size = (word & 0x00C0) >> 6;
+			if (size == 3) break;
+
+			const int sreg = word & 0x0007;
+			const int dreg = (word & 0x0E00) >> 9;
+			switch(opnum) {
+				case 6  : in->mnemonic = M_ADDX;
+					break;
+				case 81 : in->mnemonic = M_SUBX;
+					break;
+				case 27 : in->mnemonic = M_CMPM;
+					break;
+			}
+			in->size = size;
+			if (opnum == 27) {
+				setreg(&in->op[0], 3, sreg);
+				setreg(&in->op[1], 3, dreg);
+			} else if ((word & 0x0008) == 0) {
+				/* reg-reg */
+				setreg(&in->op[0], 0, sreg);
+				setreg(&in->op[1], 0, dreg);
 			} else {
-				sprintf(out_s, "$%08x", data1);
+				/* mem-mem */
+				setreg(&in->op[0], 4, sreg);
+				setreg(&in->op[1], 4, dreg);
 			}
-			*absaddr = data1;
-		}	break;
-		case 8  : {
-			const int data1 = getword(gBuf);
-			const int data2 = getword(gBuf);
-			int l;
-			if ((l = findLabelByAddr(lbls, (data1 << 16) | data2)) != -1) {
-				sprintf(out_s, "$%04x%04x<%s>", data1, data2, lbls->labels[l].name);
+			in->nops = 2;
+		} return true;
+		case 9  :
+		case 11 :
+		case 39 :
+		case 41 :
+		case 63 :
+		case 65 :
+		case 67 :
+		case 69 : { /* ASL, ASR, LSL, LSR, ROL, ROR, ROXL, ROXR */
+			const int size = (word & 0x00C0) >> 6;
+			if (size == 3) break;
+
+			switch(opnum) {
+				case 9  : in->mnemonic = M_ASL;
+					break;
+				case 11 : in->mnemonic = M_ASR;
+					break;
+				case 39 : in->mnemonic = M_LSL;
+					break;
+				case 41 : in->mnemonic = M_LSR;
+					break;
+				case 63 : in->mnemonic = M_ROL;
+					break;
+				case 65 : in->mnemonic = M_ROR;
+					break;
+				case 67 : in->mnemonic = M_ROXL;
+					break;
+				case 69 : in->mnemonic = M_ROXR;
+					break;
+			}
+			in->size = size;
+			int count = (word & 0x0E00) >> 9;
+			if (((word & 0x0020) >> 5) == 0) { /* imm */
+				if (count == 0) count = 8;
+				setop(&in->op[0], OPK_QUICK, count);
+			} else { /* count in dreg */
+				setreg(&in->op[0], 0, count);
+			}
+			setreg(&in->op[1], 0, word & 0x0007);
+			in->nops = 2;
+		} return true;
+		case 10 :
+		case 12 :
+		case 40 :
+		case 42 :
+		case 64 :
+		case 66 :
+		case 68 : /* Memory-to-memory */
+		case 70 : { /* ASL, ASR, LSL, LSR, ROL, ROR, ROXL, ROXR */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			if ((dmode <= 1) || (dmode >= 9)) break; /* Invalid */
+
+			switch(opnum) {
+				case 10 : in->mnemonic = M_ASL;
+					break;
+				case 12 : in->mnemonic = M_ASR;
+					break;
+				case 40 : in->mnemonic = M_LSL;
+					break;
+				case 42 : in->mnemonic = M_LSR;
+					break;
+				case 64 : in->mnemonic = M_ROL;
+					break;
+				case 66 : in->mnemonic = M_ROR;
+					break;
+				case 68 : in->mnemonic = M_ROXL;
+					break;
+				case 70 : in->mnemonic = M_ROXR;
+					break;
+			}
+			in->size = NOSIZE;
+			decodeea(d, in, &in->op[0], dmode, dreg, 0);
+			in->nops = 1;
+		} return true;
+		case 13 : {/* Bcc */
+			in->mnemonic = M_BCC;
+			in->size = NOSIZE;
+			in->cc = (word & 0x0F00) >> 8;
+
+			int offset = (word & 0x00FF);
+			if (offset != 0) {
+				if (offset >= 128) offset -= 256;
+				in->targetAddress = d->address + offset;
+				in->op[0].size = 0;
 			} else {
-				sprintf(out_s, "$%04x%04x", data1, data2);
+				offset = getext(d, in);
+				if (offset >= 32768l) offset -= 65536l;
+				in->targetAddress = d->address - 2 + offset;
+				in->op[0].size = 1;
 			}
-			*absaddr = (data1<<16) | data2;
-		} break;
-		case 11 : {
-			const int data1 = getword(gBuf);
+			setop(&in->op[0], OPK_BRANCH, offset);
+			in->op[0].absaddr = in->targetAddress;
+			in->op[0].hasabs = 1;
+			in->nops = 1;
+			in->isBranch = 1;
+		} return true;
+		case 14 :
+		case 15 :
+		case 16 :
+		case 17 : /* BCHG + BCLR */
+		case 18 :
+		case 19 : /* BSET */
+		case 20 :
+		case 21 : {/* BTST */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+
+			if (dmode == 1) break;
+			if (dmode >= 11) break;
+			if ((opnum < 20) && (dmode >= 9)) break;
+
+			switch(opnum) {
+				case 14 : /* BCHG_DREG */
+				case 15 : /* BCHG_IMM */
+					in->mnemonic = M_BCHG;
+					break;
+				case 16 : /* BCLR_DREG */
+				case 17 : /* BCLR_IMM */
+					in->mnemonic = M_BCLR;
+					break;
+				case 18 : /* BSET_DREG */
+				case 19 : /* BSET_IMM */
+					in->mnemonic = M_BSET;
+					break;
+				case 20 : /* BTST_DREG */
+				case 21 : /* BTST_IMM */
+					in->mnemonic = M_BTST;
+					break;
+			}
+			in->size = NOSIZE;
+			if (opnum & 1) {
+				setop(&in->op[0], OPK_QUICK, getext(d, in) & 0x00FF);
+			} else {
+				setreg(&in->op[0], 0, (word & 0x0E00) >> 9);
+			}
+			decodeea(d, in, &in->op[1], dmode, dreg, 0);
+			in->nops = 2;
+		} return true;
+		case 22 : /* CHK */
+		case 29 :
+		case 30 :
+		case 52 :
+		case 53 : /* DIVS, DIVU, MULS, MULU */
+		case 24 : {/* CMP */
+			const int smode = getmode(word);
+			if ((smode == 1) && (opnum != 24)) break;
+			if (smode >= 12) break;
+
+			const int sreg = word & 0x0007;
+			const int dreg = (word & 0x0E00) >> 9;
+
+			int size;
+			if (opnum == 24) {
+				size = (word & 0x00C0) >> 6;
+			} else {
+				size = 1; /* WORD */
+			}
+			if (size == 3) break;
+
+			in->size = NOSIZE;
+			switch(opnum) {
+				case 22 : /* CHK */
+					in->mnemonic = M_CHK;
+					break;
+				case 24 : /* CMP */
+					in->mnemonic = M_CMP;
+					in->size = size;
+					break;
+				case 29 : /* DIVS */
+					in->mnemonic = M_DIVS;
+					break;
+				case 30 : /* DIVU */
+					in->mnemonic = M_DIVU;
+					break;
+				case 52 : /* MULS */
+					in->mnemonic = M_MULS;
+					break;
+				case 53 : /* MULU */
+					in->mnemonic = M_MULU;
+					break;
+			}
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			setreg(&in->op[1], 0, dreg);
+			in->nops = 2;
+		} return true;
+		case 23 : {/* CLR */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			if ((dmode == 1) || (dmode >= 9)) break; /* Invalid */
+
+			const int size = (word & 0x00C0) >> 6;
+			if (size == 3) break;
+
+			in->mnemonic = M_CLR;
+			in->size = size;
+			decodeea(d, in, &in->op[0], dmode, dreg, size);
+			in->nops = 1;
+		} return true;
+		case 25 : {/* CMPA */
+			const int smode = getmode(word);
+			const int sreg = word & 0x0007;
+			const int areg = (word & 0x0E00) >> 9;
+			const int size = ((word & 0x0100) >> 8) + 1;
+
+			in->mnemonic = M_CMPA;
+			in->size = size;
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			setreg(&in->op[1], 1, areg);
+			in->nops = 2;
+		} return true;
+		case 28 : { /* DBcc */
+			in->mnemonic = M_DBCC;
+			in->size = NOSIZE;
+			in->cc = (word & 0x0F00) >> 8;
+
+			int offset = getext(d, in);
+			if (offset >= 32768) offset -= 65536;
+			setreg(&in->op[0], 0, word & 0x0007);
+			setop(&in->op[1], OPK_BRANCH, offset);
+			in->op[1].size = 1;
+			in->op[1].absaddr = d->address - 2 + offset;
+			in->op[1].hasabs = 1;
+			in->nops = 2;
+			in->isBranch = 1;
+			in->targetAddress = d->address - 2 + offset;
+		} return true;
+		case 33 : { /* EXG */
+			const int dmode = (word & 0x00F8) >> 3;
+			/*	8 - Both Dreg
+				9 - Both Areg
+				17 - Dreg + Areg */
+			if ((dmode != 8) && (dmode != 9) && (dmode != 17)) break;
+
+			const int reg1 = (word & 0x0E00) >> 9;
+			const int reg2 = word & 0x0007;
+			in->mnemonic = M_EXG;
+			in->size = NOSIZE;
+
+			switch(dmode) {
+				case 8  : setreg(&in->op[0], 0, reg1);
+					setreg(&in->op[1], 0, reg2);
+					break;
+				case 9  : setreg(&in->op[0], 1, reg1);
+					setreg(&in->op[1], 1, reg2);
+					break;
+				case 17 : setreg(&in->op[0], 0, reg1);
+					setreg(&in->op[1], 1, reg2);
+					break;
+			}
+			in->nops = 2;
+		} return true;
+		case 34 : {/* EXT */
+			in->mnemonic = M_EXT;
+			in->size = ((word & 0x0040) >> 6) + 1;
+			setreg(&in->op[0], 0, word & 0x0007);
+			in->nops = 1;
+		} return true;
+		case 35 :
+		case 36 : {/* JMP + JSR */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+
+			if (dmode <= 1) break;
+			if ((dmode == 3) || (dmode == 4)) break;
+			if (dmode >= 11) break; /* Invalid */
+
+			switch(opnum) {
+				case 35 : in->mnemonic = M_JMP;
+					in->isJump = 1;
+					break;
+				case 36 : in->mnemonic = M_JSR;
+					in->isBranch = 1;
+					break;
+			}
+			in->size = NOSIZE;
+			decodeea(d, in, &in->op[0], dmode, dreg, 0);
+			in->nops = 1;
+			// There are a few JSR (A0) computed jumps.  These need an address
+			// to not mess up the basic block finding too badly.  Clearly, we don't know where
+			// this goes to until we debug further.  This might miss some basic blocks.
+			in->targetAddress = in->op[0].hasabs ? in->op[0].absaddr : 0;
+		} return true;
+		case 37 : {/* LEA */
+			const int smode = getmode(word);
+			if ((smode == 0) || (smode == 1)) break;
+			if ((smode == 3) || (smode == 4)) break;
+			if (smode >= 11) break;
+
+			const int sreg = word & 0x0007;
+			in->mnemonic = M_LEA;
+			in->size = NOSIZE;
+			decodeea(d, in, &in->op[0], smode, sreg, 0);
+			setreg(&in->op[1], 1, (word & 0x0E00) >> 9);
+			in->nops = 2;
+		} return true;
+		case 38 : {/* LINK */
+			int offset = getext(d, in);
+			if (offset >= 32768) offset -= 65536;
+			in->mnemonic = M_LINK;
+			in->size = NOSIZE;
+			setreg(&in->op[0], 1, word & 0x0007);
+			setop(&in->op[1], OPK_LINK, offset);
+			in->nops = 2;
+		} return true;
+		case 43 : {/* MOVE */
+			const int smode = getmode(word);
+			const int data = ((word & 0x0E00) >> 9) | ((word & 0x01C0) >> 3);
+			const int dmode = getmode(data);
+
+			const int sreg = word & 0x0007;
+			const int dreg = data & 0x0007;
+
+			int size = (word & 0x3000) >> 12; /* 1=B, 2=L, 3=W */
+			if (size == 0) break;
 			switch(size) {
-				case 0 : sprintf(out_s, "#$%02x", (data1 & 0x00FF));
-					*absaddr = data1 & 0x00FF;
+				case 1 : size = 0;
 					break;
-				case 1 : sprintf(out_s, "#$%04x", data1);
-					*absaddr = data1;
+				case 2 : size = 2;
+					break;
+				case 3 : size = 1;
 					break;
-				case 2 : {
-					const int data2 = getword(gBuf);
-					int l;
-					if ((l = findLabelByAddr(lbls, (data1 << 16) | data2)) != -1) {
-						sprintf(out_s, "#$%04x%04x<%s>", data1, data2, lbls->labels[l].name);
-					} else {
-						sprintf(out_s, "#$%04x%04x", data1, data2);
-					}
-					*absaddr = (data1<<16) | data2;
-				} break;
 			}
-		} break;
-		default : sprintf(out_s, "?"); fprintf(stderr, "Mode out of range in sprintmode = %i\n", mode);
-			break;
+			/* 0=B, 1=W, 2=L */
+
+			/* check for illegal modes */
+			// smode=1, size=1 is legal; 36 0d
+			// if ((smode == 1) && (size == 1)) break;
+			// smode=9 is legal; 2d 40 ff ec
+			// smode=10 is legal; 30 3b 00 00
+			// if ((smode == 9) || (smode == 10)) break;
+			if (smode > 11) break;
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+
+			in->mnemonic = M_MOVE;
+			in->size = size;
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			decodeea(d, in, &in->op[1], dmode, dreg, size);
+			in->nops = 2;
+		} return true;
+		case 44 : /* MOVE to CCR */
+		case 45 : {/* MOVE to SR */
+			const int smode = getmode(word);
+			const int sreg = word & 0x0007;
+			const int size = 1; /* WORD */
+
+			if (smode == 1) break;
+			if (smode >= 12) break;
+
+			in->mnemonic = M_MOVE;
+			in->size = size;
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			setop(&in->op[1], (opnum == 44) ? OPK_CCR : OPK_SR, 0);
+			in->nops = 2;
+		} return true;
+		case 46 : {/* MOVE from SR */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = 1; /* WORD */
+
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+
+			in->mnemonic = M_MOVE;
+			in->size = size;
+			setop(&in->op[0], OPK_SR, 0);
+			decodeea(d, in, &in->op[1], dmode, dreg, size);
+			in->nops = 2;
+		} return true;
+		case 47 : { /* MOVE USP */
+			in->mnemonic = M_MOVE;
+			in->size = NOSIZE;
+			if ((word & 0x0008) == 0) {
+				/* to USP */
+				setreg(&in->op[0], 1, word & 0x0007);
+				setop(&in->op[1], OPK_USP, 0);
+			} else {
+				/* from USP */
+				setop(&in->op[0], OPK_USP, 0);
+				setreg(&in->op[1], 1, word & 0x0007);
+			}
+			in->nops = 2;
+		} return true;
+		case 48 : {/* MOVEA */
+			const int smode = getmode(word);
+			const int sreg = word & 0x0007;
+			int size = (word & 0x3000) >> 12;
+
+			/* 2 = L, 3 = W */
+			if (size <= 1) break;
+			if (size == 3) size = 1;
+			/* 1 = W, 2 = L */
+
+			in->mnemonic = M_MOVEA;
+			in->size = size;
+			decodeea(d, in, &in->op[0], smode, sreg, size);
+			setreg(&in->op[1], 1, (word & 0x0e00) >> 9);
+			in->nops = 2;
+		} return true;
+		case 49 : {/* MOVEM */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = ((word & 0x0040) >> 6) + 1;
+
+			if ((dmode == 0) || (dmode == 1)) break;
+			if (dmode >= 11) break;
+
+			const int dir = (word & 0x0400) >> 10; /* 1 == from mem */
+			if ((dir == 0) && (dmode == 3)) break;
+			if ((dir == 1) && (dmode == 4)) break;
+
+			int data = getext(d, in);
+			if (dmode == 4) { /* dir == 0 if dmode == 4 !! */
+				/* reverse bits in data */
+				int temp = data;
+				data = 0;
+				for (int i = 0; i <= 15; ++i) {
+					data = (data >> 1) | (temp & 0x8000);
+					temp = temp << 1;
+				}
+			}
+
+			in->mnemonic = M_MOVEM;
+			in->size = size;
+			setop(&in->op[dir], OPK_REGLIST, data);
+			decodeea(d, in, &in->op[dir ^ 1], dmode, dreg, size);
+			in->nops = 2;
+		} return true;
+		case 50 : {/* MOVEP */
+			const int dreg = (word & 0x0E00) >> 9;
+			const int areg = word & 0x0007;
+			const int size = ((word & 0x0040) >> 6) + 1;
+
+			if (size == 3) break;
+
+			const int data = getext(d, in);
+			in->mnemonic = M_MOVEP;
+			in->size = size;
+			const int tomem = (word & 0x0080) != 0; /* data reg -> mem */
+			setop(&in->op[tomem], OPK_MOVEP, data);
+			in->op[tomem].reg = areg;
+			setreg(&in->op[tomem ^ 1], 0, dreg);
+			in->nops = 2;
+		} return true;
+		case 51 : { /* MOVEQ */
+			in->mnemonic = M_MOVEQ;
+			in->size = NOSIZE;
+			setop(&in->op[0], OPK_MOVEQ, word & 0x00FF);
+			setreg(&in->op[1], 0, (word & 0x0E00) >> 9);
+			in->nops = 2;
+		} return true;
+		case 54 : /* NBCD */
+		case 55 :
+		case 56 :
+		case 58 : { /* NEG, NEGX + NOT */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = (word & 0x00C0) >> 6;
+
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+			if (size == 3) break;
+
+			switch(opnum) {
+				case 54 : in->mnemonic = M_NBCD;
+					break;
+				case 55 : in->mnemonic = M_NEG;
+					break;
+				case 56 : in->mnemonic = M_NEGX;
+					break;
+				case 58 : in->mnemonic = M_NOT;
+					break;
+			}
+			in->size = size;
+			decodeea(d, in, &in->op[0], dmode, dreg, size);
+			in->nops = 1;
+		} return true;
+		case 57 :
+		case 62 :
+		case 71 :
+		case 72 :
+		case 73 :
+		case 76 :
+		case 85 : { /* NOP, RESET, RTE, RTR, RTS, STOP, TRAPV */
+			switch(opnum) {
+				case 57 : in->mnemonic = M_NOP;
+					break;
+				case 62 : in->mnemonic = M_RESET;
+					break;
+				case 71 : in->mnemonic = M_RTE;
+					break;
+				case 72 : in->mnemonic = M_RTR;
+					break;
+				case 73 : in->mnemonic = M_RTS;
+					in->isRet = 1;
+					break;
+				case 76 : in->mnemonic = M_STOP;
+					break;
+				case 85 : in->mnemonic = M_TRAPV;
+					break;
+			}
+			in->size = NOSIZE;
+		} return true;
+		case 61 : { /* PEA */
+			const int smode = getmode(word);
+			if (smode <= 1) break;
+			if ((smode == 3) || (smode == 4)) break;
+			if (smode >= 11) break;
+
+			in->mnemonic = M_PEA;
+			in->size = NOSIZE;
+			decodeea(d, in, &in->op[0], smode, word & 0x0007, 0);
+			in->nops = 1;
+		} return true;
+		case 75 : {/* Scc */
+			const int dmode = getmode(word);
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+
+			in->mnemonic = M_SCC;
+			in->size = NOSIZE;
+			in->cc = (word & 0x0F00) >> 8;
+			decodeea(d, in, &in->op[0], dmode, word & 0x0007, 0);
+			in->nops = 1;
+		} return true;
+		case 82 : {/* SWAP */
+			in->mnemonic = M_SWAP;
+			in->size = NOSIZE;
+			setreg(&in->op[0], 0, word & 0x0007);
+			in->nops = 1;
+		} return true;
+		case 83 : { /* TAS */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+
+			in->mnemonic = M_TAS;
+			in->size = NOSIZE;
+			decodeea(d, in, &in->op[0], dmode, dreg, 0);
+			in->nops = 1;
+		} return true;
+		case 84 : { /* TRAP */
+			in->mnemonic = M_TRAP;
+			in->size = NOSIZE;
+			setop(&in->op[0], OPK_TRAP, word & 0x000F);
+			in->nops = 1;
+		} return true;
+		case 86 : { /* TST */
+			const int dmode = getmode(word);
+			const int dreg = word & 0x0007;
+			const int size = (word & 0x00C0) >> 6;
+
+			if (dmode == 1) break;
+			if (dmode >= 9) break;
+			if (size == 3) break;
+
+			in->mnemonic = M_TST;
+			in->size = NOSIZE; // The listing shows TST without a size.
+			decodeea(d, in, &in->op[0], dmode, dreg, size);
+			in->nops = 1;
+		} return true;
+		case 87 : {/* UNLK */
+			in->mnemonic = M_UNLK;
+			in->size = NOSIZE;
+			setreg(&in->op[0], 1, word & 0x0007);
+			in->nops = 1;
+		} return true;
+
+		default : gBufprintf("opnum out of range in switch (=%i)\n", opnum);
+			exit(1);
+	}
+	return false;
+}
+
+// decodeone() without the cache.
+static int decodeuncached(Decoder *d, int start, Instruction *retval) {
+	d->address = start;
+
+	retval->address = start;
+	const int word = getword(d);
+	retval->word = word;
+	for (const uint8_t *cand = opcands[opclass[word]]; *cand != 0; ++cand) {
+		/* Diagnostic code */
+		diagnostic_gBufprintf("(%i) ", *cand);
+		if (decodeop(d, word, *cand, retval)) {
+			retval->opnum = *cand;
+			retval->nbytes = d->address - start;
+			return 1;
+		}
 	}
+	return 0;
 }
 
 /*!
-	Decodes the addressing mode from @c instruction.
+	Decodes as decodeone() does without a cache, but finds the optab entries
+	by a linear scan rather than the decode table: the reference that the
+	table, or anything replacing it, is checked against.
 
-	@returns A mode in the range 0 to 11, if a valid addressing mode could be
-		determined; 12 otherwise.
+	@returns 0 if the instruction could not be decoded.
 */
-int getmode(int instruction) {
-	const int mode = (instruction & 0x0038) >> 3;
-	const int reg = instruction & 0x0007;
-
-	if (mode == 7) {
-		if (reg >= 5) {
-			return 12; /* i.e. invalid */
-		} else {
-			return 7 + reg;
+int decodescan(Decoder *d, int start, Instruction *retval) {
+	memset(retval, 0, sizeof(*retval));
+	if (bufferIsEOF(d->bin, start)) return 0;
+	d->address = start;
+
+	retval->address = start;
+	const int word = getword(d);
+	retval->word = word;
+	for (int opnum = 1; opnum <= 87; ++opnum) {
+		if ((word & optab[opnum].and) != optab[opnum].xor) continue;
+		if (decodeop(d, word, opnum, retval)) {
+			retval->opnum = opnum;
+			retval->nbytes = d->address - start;
+			return 1;
 		}
 	}
-	return mode;
+	return 0;
 }
 
-// Return 0 if failed to decode instruction in the justone case
-int disasm(Buffer *buf, unsigned long int start, unsigned long int end, Labels *labels, IList *output, int justone) {
-	address = start;
-	bufferSeek(buf, start);
-
-	int absaddr;
-	while (!bufferIsEOF(buf, address) && (address < end)) {
-		if (!rawmode) {
-			int pos;
-			char label[MAXLABELLEN+1];
-			if ((pos = findLabelByAddr(labels, address)) != -1) {
-				sprintf(label, "<%s>", labels->labels[pos].name);
-			} else {
-				label[0] = ' '; 
-				label[1] = 0;
+/*!
+	Decodes the instruction at @c start into @c retval: mnemonic, sizes,
+	operands, extension words, length and control flow.  No labels are
+	consulted and no text is produced; see sprintinstr() for that.  Results
+	come from and go to the buffer's instruction cache, if it has one.
+
+	@returns 0 if the instruction could not be decoded.
+*/
+int decodeone(Decoder *d, int start, Instruction *retval) {
+	STAT(decodeone);
+	pthread_once(&optableonce, buildoptable);
+	memset(retval, 0, sizeof(*retval));
+	if (bufferIsEOF(d->bin, start)) return 0;
+
+	ICache *c = d->bin->icache;
+	if (c == NULL || fetchptr(d, start, 2) == NULL) return decodeuncached(d, start, retval);
+
+	const int sec = d->sec - d->bin->sections;
+	int ok;
+	if (icacheLookup(c, sec, start, retval, &ok)) {
+		d->hits++;
+		d->address = start + retval->nbytes;
+		return ok;
+	}
+	d->misses++;
+	ok = decodeuncached(d, start, retval);
+	icacheInsert(c, sec, start, retval, ok);
+	return ok;
+}
+
+static void sprintlabel(char *out_s, const char *fmt, Labels *lbls, int addr) {
+	int pos;
+	if ((pos = findLabelByAddr(lbls, addr)) != -1) {
+		sprintf(out_s, fmt, lbls->labels[pos].name);
+	} else out_s[0] = 0;
+}
+
+/*!
+	Prints the MOVEM register list @c data, one bit per register from D0 to A7.
+	Every register or range is followed by a comma.
+*/
+static void sprintreglist(char *out_s, int data) {
+	int rlist[11];
+	out_s[0] = 0;
+	for (int bank = 0; bank < 2; bank++) {
+		const char r = bank ? 'A' : 'D';
+		for (int i = 0 ; i <= 7; ++i) {
+			rlist[i + 1] = (data >> (8*bank + i)) & 0x0001;
+		}
+		rlist[0] = 0;
+		rlist[9] = 0;
+		rlist[10] = 0;
+
+		for (int i = 1; i <= 8 ; ++i) {
+			char temp_s[8];
+			if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
+				(rlist[i+1] == 1) && (rlist[i+2] == 1)) {
+				/* first reg in list */
+				sprintf(temp_s, "%c%i-", r, i - 1);
+				strcat(out_s, temp_s);
+			}
+			if ((rlist[i] == 1) && (rlist[i+1] == 0)) {
+				sprintf(temp_s, "%c%i,", r, i - 1);
+				strcat(out_s, temp_s);
+			}
+			if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
+				(rlist[i+1] == 1) && (rlist[i+2] == 0)) {
+				sprintf(temp_s, "%c%i,", r, i - 1);
+				strcat(out_s, temp_s);
 			}
-			gBufprintf("%08x%s ", address, label);
-		} else {
-			gBufprintf("        ");
 		}
-		Instruction instr;
-		memset(&instr, 0, sizeof(instr));
-		instr.address = address;
-//		const uint32_t start_address = address;
-		const int word = getword(buf);
-		bool decoded = false;
-		char opcode_s[50], operand_s[101];
-		for (int opnum = 1; opnum <= 87; ++opnum) {
-			if ((word & optab[opnum].and) == optab[opnum].xor) {
-				/* Diagnostic code */
-				diagnostic_gBufprintf("(%i) ",opnum); 
-
-				switch(opnum) { /* opnum = 1..85 */
-					case 1  :
-					case 74 : { /* ABCD + SBCD */
-						const int sreg = word & 0x0007;
-						const int dreg = (word & 0x0E00) >> 9;
-						instr.opnum = opnum;
-						instr.soperand = sreg;
-						instr.doperand = dreg;
-						if (opnum == 1) {
-							sprintf(opcode_s, "ABCD");
-						} else {
-							sprintf(opcode_s, "SBCD");
-						}
-						if ((word & 0x0008) == 0) {
-							/* reg-reg */
-							instr.src = instr.dst = DATA_REG;
-							sprintf(operand_s, "D%i,D%i", sreg, dreg);
-						} else {
-							/* mem-mem */
-							instr.src = instr.dst = ADDR_REG;
-							instr.prepost = PREDECR;
-							sprintf(operand_s, "-(A%i),-(A%i)", sreg, dreg);
-						}
-						decoded = true;
-					} break;
-					case 2  :
-					case 7  :
-					case 31 :
-					case 59 : /* ADD, AND, EOR, OR */
-					case 77 : { /* SUB */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-
-						/* Diagnostic code */
-						diagnostic_gBufprintf("dmode = %i, dreg = %i, size = %i",dmode,dreg,size);
-
-						if (size == 3) break;
-						/*
-						if (dmode == 1) break;
-						*/
-						if ((opnum ==  2) && (dmode == 1) && (size == 0)) break;
-						if ((opnum == 77) && (dmode == 1) && (size == 0)) break;
-
-						const int dir = (word & 0x0100) >> 8; /* 0 = dreg dest */
-						if ((opnum == 31) && (dir == 0)) break;
-						/* dir == 1 : Dreg is source */
-						if ((dir == 1) && (dmode >= 9)) break;
-
-						switch(opnum) {
-							case  2 : sprintf(opcode_s, "ADD.%c", size_arr[size]);
-								break;
-							case  7 : sprintf(opcode_s,"AND.%c", size_arr[size]);
-								break;
-							case 31 : sprintf(opcode_s, "EOR.%c", size_arr[size]);
-								break;
-							case 59 : sprintf(opcode_s, "OR.%c", size_arr[size]);
-								break;
-							case 77 : sprintf(opcode_s, "SUB.%c", size_arr[size]);
-								break;
-						}
-
-						char dest_s[50];
-						sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-
-						const int sreg = (word & 0x0E00) >> 9;
-						char source_s[50];
-						sprintf(source_s, "D%i", sreg);
-						/* reverse source & dest if dir == 0 */
-						if (dir != 0) {
-							sprintf(operand_s, "%s,%s", source_s, dest_s);
-						} else {
-							sprintf(operand_s, "%s,%s", dest_s, source_s);
-						}
-						decoded = true;
-					} break;
-					case 3  :
-					case 78 : { /* ADDA + SUBA */
-						const int smode = getmode(word);
-						const int sreg = word & 0x0007;
-						//const int dreg = (word & 0x0E00) >> 9;
-						const int size = ((word & 0x0100) >> 8) + 1;
-						switch(opnum) {
-							case  3 : sprintf(opcode_s, "ADDA.%c", size_arr[size]);
-								break;
-							case 78 : sprintf(opcode_s, "SUBA.%c", size_arr[size]);
-								break;
-						}
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						sprintf(operand_s, "%s,A%i", source_s, sreg);
-						decoded = true;
-					} break;
-					case 4  :
-					case 8  :
-					case 26 :
-					case 32 :
-					case 60 :
-					case 79 : { /* ADDI, ANDI, CMPI, EORI, ORI, SUBI */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-
-						if (size == 3) break;
-						if (dmode == 1) break;
-						if ((dmode == 9) || (dmode == 10)) break; /* Invalid */
-						if (dmode == 12) break;
-						if ((dmode == 11) && /* ADDI, CMPI, SUBI */
-							((opnum == 4) || (opnum == 26) || (opnum == 79))) break;
-
-						switch(opnum) {
-							case  4 : sprintf(opcode_s, "ADDI.%c", size_arr[size]);
-								break;
-							case  8 : sprintf(opcode_s, "ANDI.%c", size_arr[size]);
-								break;
-							case 26 : sprintf(opcode_s, "CMPI.%c", size_arr[size]);
-								break;
-							case 32 : sprintf(opcode_s, "EORI.%c", size_arr[size]);
-								break;
-							case 60 : sprintf(opcode_s, "ORI.%c", size_arr[size]);
-								break;
-							case 79 : sprintf(opcode_s, "SUBI.%c", size_arr[size]);
-								break;
-						}
-
-						const int data = getword(buf);
-						char source_s[50];
-						switch(size) {
-							case 0 : sprintf(source_s, "#$%02x", (data & 0x00FF));
-								break;
-							case 1 : sprintf(source_s, "#$%04x", data);
-								break;
-							case 2 :
-								sprintf(source_s, "#$%04x%04x", data, getword(buf));
-								break;
-						}
-
-						char dest_s[50];
-						if (dmode == 11) {
-							sprintf(dest_s, "SR");
-						} else {
-							sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-						}
-						sprintf(operand_s, "%s,%s", source_s, dest_s);
-						decoded = true;
-					} break;
-					case 5  :
-					case 80 : {/* ADDQ + SUBQ */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-
-						if (size == 3) break;
-						if (dmode >= 9) break;
-						if ((size == 0) && (dmode == 1)) break;
-
-						if (opnum == 5) {
-							sprintf(opcode_s,"ADDQ.%c",size_arr[size]);
-						} else {
-							sprintf(opcode_s,"SUBQ.%c",size_arr[size]);
-						}
-						char dest_s[50];
-						sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-						const int count = (word & 0x0E00) >> 9;
-						sprintf(operand_s, "#%i,%s", count ? count : 8, dest_s);
-						decoded = true;
-					} break;
-					case 6  :
-					case 81 : /* ADDX + SUBX */
-					case 27 : { /* CMPM */
-						const int size = (word & 0x00C0) >> 6;
-						if (size == 3) break;
-
-						const int sreg = word & 0x0007;
-						const int dreg = (word & 0x0E00) >> 9;
-						switch(opnum) {
-							case 6  : sprintf(opcode_s, "ADDX.%c", size_arr[size]);
-								break;
-							case 81 : sprintf(opcode_s, "SUBX.%c", size_arr[size]);
-								break;
-							case 27 : sprintf(opcode_s, "CMPM.%c", size_arr[size]);
-								break;
-						}
-						if ((opnum != 27) && ((word & 0x0008) == 0)) {
-							/* reg-reg */
-							sprintf(operand_s,"D%i,D%i",sreg,dreg);
-						} else {
-							/* mem-mem */
-							sprintf(operand_s,"-(A%i),-(A%i)",sreg,dreg);
-						}
-						if (opnum == 27) {
-							sprintf(operand_s,"(A%i)+,(A%i)+",sreg,dreg);
-						}
-						decoded = true;
-					} break;
-					case 9  :
-					case 11 :
-					case 39 :
-					case 41 :
-					case 63 :
-					case 65 :
-					case 67 :
-					case 69 : { /* ASL, ASR, LSL, LSR, ROL, ROR, ROXL, ROXR */
-						//const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-						if (size == 3) break;
-
-						switch(opnum) {
-							case 9  : sprintf(opcode_s, "ASL.%c", size_arr[size]);
-								break;
-							case 11 : sprintf(opcode_s, "ASR.%c", size_arr[size]);
-								break;
-							case 39 : sprintf(opcode_s, "LSL.%c", size_arr[size]);
-								break;
-							case 41 : sprintf(opcode_s, "LSR.%c", size_arr[size]);
-								break;
-							case 63 : sprintf(opcode_s, "ROL.%c", size_arr[size]);
-								break;
-							case 65 : sprintf(opcode_s, "ROR.%c", size_arr[size]);
-								break;
-							case 67 : sprintf(opcode_s, "ROXL.%c", size_arr[size]);
-								break;
-							case 69 : sprintf(opcode_s, "ROXR.%c", size_arr[size]);
-								break;
-						}
-						int count = (word & 0x0E00) >> 9;
-						if (((word & 0x0020) >> 5) == 0) { /* imm */
-							if (count == 0) count = 8;
-							sprintf(operand_s, "#%i,D%i", count, (word & 0x0007));
-						} else { /* count in dreg */
-							sprintf(operand_s, "D%i,D%i", count, (word & 0x0007));
-						}
-						decoded = true;
-					} break;
-					case 10 :
-					case 12 :
-					case 40 :
-					case 42 :
-					case 64 :
-					case 66 :
-					case 68 : /* Memory-to-memory */
-					case 70 : { /* ASL, ASR, LSL, LSR, ROL, ROR, ROXL, ROXR */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						if ((dmode <= 1) || (dmode >= 9)) break; /* Invalid */
-
-						switch(opnum) {
-							case 10 : sprintf(opcode_s,"ASL");
-								break;
-							case 12 : sprintf(opcode_s,"ASR");
-								break;
-							case 40 : sprintf(opcode_s,"LSL");
-								break;
-							case 42 : sprintf(opcode_s,"LSR");
-								break;
-							case 64 : sprintf(opcode_s,"ROL");
-								break;
-							case 66 : sprintf(opcode_s,"ROR");
-								break;
-							case 68 : sprintf(opcode_s,"ROXL");
-								break;
-							case 70 : sprintf(opcode_s,"ROXR");
-								break;
-						}
-						sprintmode(buf, labels, dmode, dreg, 0, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 13 : {/* Bcc */
-						const int cc = (word & 0x0F00) >> 8;
-						sprintf(opcode_s, "%s", bra_tab[cc]);
-
-						int offset = (word & 0x00FF);
-						if (offset != 0) {
-							if (offset >= 128) offset -= 256;
-							instr.targetAddress = address + offset;
-							if (!rawmode) {
-								int label = findLabelByAddr(labels, address+offset);
-								char buf[128];
-								if (label != -1) sprintf(buf, "(%s)", labels->labels[label].name);
-								else buf[0] = 0;
-								sprintf(operand_s, "$%08x%s", address + offset, buf);
-							} else {
-								sprintf(operand_s, "*%+d", offset);
-							}
-						} else {
-							offset = getword(buf);
-							if (offset >= 32768l) offset -= 65536l;
-							instr.targetAddress = address - 2 + offset;
-							if (!rawmode) {
-								int label = findLabelByAddr(labels, address - 2 + offset);
-								char buf[128];
-								if (label != -1) sprintf(buf, "<%s>", labels->labels[label].name);
-								else buf[0] = 0;
-								sprintf(operand_s, "$%08x%s" , address - 2 + offset, buf);
-							} else {
-								sprintf(operand_s, "*%+d", offset);
-							}
-						}
-						instr.isBranch = 1;
-						decoded = true;
-					} break;
-					case 14 :
-					case 15 :
-					case 16 :
-					case 17 : /* BCHG + BCLR */
-					case 18 :
-					case 19 : /* BSET */
-					case 20 :
-					case 21 : {/* BTST */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-
-						if (dmode == 1) break;
-						if (dmode >= 11) break;
-						if ((opnum < 20) && (dmode >= 9)) break;
-
-						const int sreg = (word & 0x0E00) >> 9;
-						char source_s[50];
-						switch(opnum) {
-							case 14 : /* BCHG_DREG */
-								sprintf(opcode_s, "BCHG");
-								sprintf(source_s, "D%i", sreg);
-								break;
-							case 15 : {/* BCHG_IMM */
-								sprintf(opcode_s, "BCHG");
-								const int data = getword(buf) & 0x00FF;
-								sprintf(source_s, "#%i", data);
-							} break;
-							case 16 : /* BCLR_DREG */
-								sprintf(opcode_s, "BCLR");
-								sprintf(source_s, "D%i", sreg);
-								break;
-							case 17 : {/* BCLR_IMM */
-								sprintf(opcode_s, "BCLR");
-								const int data = getword(buf) & 0x00FF;
-								sprintf(source_s, "#%i", data);
-							} break;
-							case 18 : /* BSET_DREG */
-								sprintf(opcode_s, "BSET");
-								sprintf(source_s, "D%i", sreg);
-								break;
-							case 19 : { /* BSET_IMM */
-								sprintf(opcode_s, "BSET");
-								const int data = getword(buf) & 0x00FF;
-								sprintf(source_s, "#%i", data);
-							} break;
-							case 20 : /* BTST_DREG */
-								sprintf(opcode_s,"BTST");
-								sprintf(source_s, "D%i", sreg);
-								break;
-							case 21 : {/* BTST_IMM */
-								sprintf(opcode_s,"BTST");
-								const int data = getword(buf) & 0x00FF;
-								sprintf(source_s, "#%i", data);
-							} break;
-						}
-						char dest_s[50];
-						sprintmode(buf, labels, dmode, dreg, 0, dest_s, &absaddr);
-						sprintf(operand_s, "%s,%s", source_s, dest_s);
-						decoded = true;
-					} break;
-					case 22 : /* CHK */
-					case 29 :
-					case 30 :
-					case 52 :
-					case 53 : /* DIVS, DIVU, MULS, MULU */
-					case 24 : {/* CMP */
-						const int smode = getmode(word);
-						if ((smode == 1) && (opnum != 24)) break;
-						if (smode >= 12) break;
-
-						const int sreg = word & 0x0007;
-						const int dreg = (word & 0x0E00) >> 9;
-
-						int size;
-						if (opnum == 24) {
-							size = (word & 0x00C0) >> 6;
-						} else {
-							size = 1; /* WORD */
-						}
-						if (size == 3) break;
-
-						switch(opnum) {
-							case 22 : /* CHK */
-								sprintf(opcode_s, "CHK");
-								break;
-							case 24 : /* CMP */
-								sprintf(opcode_s, "CMP.%c", size_arr[size]);
-								break;
-							case 29 : /* DIVS */
-								sprintf(opcode_s, "DIVS");
-								break;
-							case 30 : /* DIVU */
-								sprintf(opcode_s, "DIVU");
-								break;
-							case 52 : /* MULS */
-								sprintf(opcode_s, "MULS");
-								break;
-							case 53 : /* MULU */
-								sprintf(opcode_s, "MULU");
-								break;
-						}
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						sprintf(operand_s, "%s,D%i", source_s, dreg);
-						decoded = true;
-					} break;
-					case 23 : {/* CLR */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						if ((dmode == 1) || (dmode >= 9)) break; /* Invalid */
-
-						const int size = (word & 0x00C0) >> 6;
-						if (size == 3) break;
-
-						sprintf(opcode_s, "CLR.%c", size_arr[size]);
-						sprintmode(buf, labels, dmode, dreg, size, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 25 : {/* CMPA */
-						const int smode = getmode(word);
-						const int sreg = word & 0x0007;
-						const int areg = (word & 0x0E00) >> 9;
-						const int size = ((word & 0x0100) >> 8) + 1;
-
-						sprintf(opcode_s, "CMPA.%c", size_arr[size]);
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						sprintf(operand_s, "%s,A%i", source_s, areg);
-						decoded = true;
-					} break;
-					case 28 : { /* DBcc */
-						const int cc = (word & 0x0F00) >> 8;
-						sprintf(opcode_s, "D%s", bra_tab[cc]);
-
-						if (cc == 0) sprintf(opcode_s, "DBT");
-						if (cc == 1) sprintf(opcode_s, "DBF");
-						int offset = getword(buf);
-						if (offset >= 32768) offset -= 65536;
-						const int dreg = word & 0x0007;
-						sprintf(operand_s, "D%i,$%08x", dreg, address - 2 + offset);
-						instr.isBranch = 1;
-						instr.targetAddress = address - 2 + offset;
-						decoded = true;
-					} break;
-					case 33 : { /* EXG */
-						const int dmode = (word & 0x00F8) >> 3;
-						/*	8 - Both Dreg
-							9 - Both Areg
-							17 - Dreg + Areg */
-						if ((dmode != 8) && (dmode != 9) && (dmode != 17)) break;
-
-						const int reg1 = (word & 0x0E00) >> 9;
-						const int reg2 = word & 0x0007;
-						sprintf(opcode_s, "EXG");
-
-						switch(dmode) {
-							case 8  : sprintf(operand_s, "D%i,D%i", reg1, reg2);
-								break;
-							case 9  : sprintf(operand_s, "A%i,A%i", reg1, reg2);
-								break;
-							case 17 : sprintf(operand_s, "D%i,A%i", reg1, reg2);
-								break;
-						}
-						decoded = true;
-					} break;
-					case 34 : {/* EXT */
-						const int dreg = word & 0x0007;
-						const int size = ((word & 0x0040) >> 6) + 1;
-						sprintf(opcode_s, "EXT.%c", size_arr[size]);
-						sprintf(operand_s, "D%i", dreg);
-						decoded = true;
-					} break;
-					case 35 :
-					case 36 : {/* JMP + JSR */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-
-						if (dmode <= 1) break;
-						if ((dmode == 3) || (dmode == 4)) break;
-						if (dmode >= 11) break; /* Invalid */
-
-						switch(opnum) {
-							case 35 : sprintf(opcode_s, "JMP");
-								instr.isJump = 1;
-								break;
-							case 36 : sprintf(opcode_s, "JSR");
-								instr.isBranch = 1;
-								break;
-						}
-						absaddr = 0; // There are a few JSR (A0) computed jumps.  These need an address
-						// to not mess up the basic block finding too badly.  Clearly, we don't know where 
-						// this goes to until we debug further.  This might miss some basic blocks.
-						sprintmode(buf, labels, dmode, dreg, 0, operand_s, &absaddr);
-						instr.targetAddress = absaddr;
-						decoded = true;
-					} break;
-					case 37 : {/* LEA */
-						const int smode = getmode(word);
-						if ((smode == 0) || (smode == 1)) break;
-						if ((smode == 3) || (smode == 4)) break;
-						if (smode >= 11) break;
-
-						const int sreg = word & 0x0007;
-						sprintf(opcode_s, "LEA");
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, 0, source_s, &absaddr);
-
-						const int dreg = (word & 0x0E00) >> 9;
-						sprintf(operand_s, "%s,A%i", source_s, dreg);
-						decoded = true;
-					} break;
-					case 38 : {/* LINK */
-						const int areg = word & 0x0007;
-						int offset = getword(buf);
-						if (offset >= 32768) offset -= 65536;
-						sprintf(opcode_s, "LINK");
-						sprintf(operand_s, "A%i,#%+i", areg, offset);
-						decoded = true;
-					} break;
-					case 43 : {/* MOVE */
-						const int smode = getmode(word);
-						const int data = ((word & 0x0E00) >> 9) | ((word & 0x01C0) >> 3);
-						const int dmode = getmode(data);
-
-						const int sreg = word & 0x0007;
-						const int dreg = data & 0x0007;
-
-						int size = (word & 0x3000) >> 12; /* 1=B, 2=L, 3=W */
-						if (size == 0) break;
-						switch(size) {
-							case 1 : size = 0;
-								break;
-							case 2 : size = 2;
-								break;
-							case 3 : size = 1;
-								break;
-						}
-						/* 0=B, 1=W, 2=L */
-
-						/*
-						gBufprintf("smode = %i dmode = %i ",smode,dmode);
-						gBufprintf("sreg = %i dreg = %i \n",sreg,dreg);
-						*/
-
-						/* check for illegal modes */
-						// smode=1, size=1 is legal; 36 0d
-						// if ((smode == 1) && (size == 1)) break;
-						// smode=9 is legal; 2d 40 ff ec
-						// smode=10 is legal; 30 3b 00 00
-						// if ((smode == 9) || (smode == 10)) break;
-						if (smode > 11) break;
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-
-						sprintf(opcode_s,"MOVE.%c",size_arr[size]);
-
-						char source_s[50], dest_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-						sprintf(operand_s, "%s,%s ", source_s, dest_s);
-						decoded = true;
-					} break;
-					case 44 : /* MOVE to CCR */
-					case 45 : {/* MOVE to SR */
-						const int smode = getmode(word);
-						const int sreg = word & 0x0007;
-						const int size = 1; /* WORD */
-
-						if (smode == 1) break;
-						if (smode >= 12) break;
-
-						sprintf(opcode_s, "MOVE.W");
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						if (opnum == 44) {
-							sprintf(operand_s, "%s,CCR", source_s);
-						} else {
-							sprintf(operand_s, "%s,SR", source_s);
-						}
-						decoded = true;
-					} break;
-					case 46 : {/* MOVE from SR */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = 1; /* WORD */
-
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-
-						sprintf(opcode_s, "MOVE.W");
-						char dest_s[50];
-						sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-						sprintf(operand_s, "SR,%s", dest_s);
-						decoded = true;
-					} break;
-					case 47 : { /* MOVE USP */
-						//const int sreg = word & 0x0007;
-						sprintf(opcode_s, "MOVE");
-						if ((word & 0x0008) == 0) {
-							/* to USP */
-							sprintf(operand_s, "A%i,USP", word & 0x0007);
-						} else {
-							/* from USP */
-							sprintf(operand_s, "USP,A%i", word & 0x0007);
-						}
-						decoded = true;
-					} break;
-					case 48 : {/* MOVEA */
-						const int smode = getmode(word);
-						const int sreg = word & 0x0007;
-						int size = (word & 0x3000) >> 12;
-
-						/* 2 = L, 3 = W */
-						if (size <= 1) break;
-						if (size == 3) size = 1;
-						/* 1 = W, 2 = L */
-
-						const int dreg = (word & 0x0e00) >> 9;
-
-						sprintf(opcode_s, "MOVEA.%c", size_arr[size]);
-
-						char source_s[50];
-						sprintmode(buf, labels, smode, sreg, size, source_s, &absaddr);
-						sprintf(operand_s, "%s,A%i", source_s, dreg);
-						decoded = true;
-					} break;
-					case 49 : {/* MOVEM */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = ((word & 0x0040) >> 6) + 1;
-
-						if ((dmode == 0) || (dmode == 1)) break;
-						if (dmode >= 11) break;
-
-						const int dir = (word & 0x0400) >> 10; /* 1 == from mem */
-						if ((dir == 0) && (dmode == 3)) break;
-						if ((dir == 1) && (dmode == 4)) break;
-
-						int data = getword(buf);
-						if (dmode == 4) { /* dir == 0 if dmode == 4 !! */
-							/* reverse bits in data */
-							int temp = data;
-							data = 0;
-							for (int i = 0; i <= 15; ++i) {
-								data = (data >> 1) | (temp & 0x8000);
-								temp = temp << 1;
-							}
-						}
-
-						char source_s[50] = "";
-						char dest_s[50] = "";
-
-						/**** DATA LIST ***/
-
-						int rlist[11];
-						for (int i = 0 ; i <= 7; ++i) {
-							rlist[i + 1] = (data >> i) & 0x0001;
-						}
-						rlist[0] = 0;
-						rlist[9] = 0;
-						rlist[10] = 0;
-
-						for (int i = 1; i <= 8 ; ++i) {
-							if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
-								(rlist[i+1] == 1) && (rlist[i+2] == 1)) {
-								/* first reg in list */
-								char temp_s[50];
-								sprintf(temp_s, "D%i-", i - 1);
-								strcat(source_s, temp_s);
-							}
-							if ((rlist[i] == 1) && (rlist[i+1] == 0)) {
-								char temp_s[50];
-								sprintf(temp_s, "D%i,", i-1);
-								strcat(source_s, temp_s);
-							}
-							if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
-								(rlist[i+1] == 1) && (rlist[i+2] == 0)) {
-								char temp_s[50];
-								sprintf(temp_s, "D%i,", i-1);
-								strcat(source_s, temp_s);
-							}
-						}
-
-						/**** ADDRESS LIST ***/
-
-						for (int i = 8; i <= 15; ++i) {
-							rlist[i - 7] = (data >> i) & 0x0001;
-						}
-						rlist[0] = 0;
-						rlist[9] = 0;
-						rlist[10] = 0;
-
-						for (int i = 1; i <= 8; ++i) {
-							if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
-								(rlist[i+1] == 1) && (rlist[i+2] == 1)) {
-								/* first reg in list */
-								char temp_s[50];
-								sprintf(temp_s, "A%i-", i - 1);
-								strcat(source_s, temp_s);
-							}
-							if ((rlist[i] == 1) && (rlist[i+1] == 0)) {
-								char temp_s[50];
-								sprintf(temp_s, "A%i,", i - 1);
-								strcat(source_s, temp_s);
-							}
-							if ((rlist[i-1] == 0) && (rlist[i] == 1) &&
-								(rlist[i+1] == 1) && (rlist[i+2] == 0)) {
-								char temp_s[50];
-								sprintf(temp_s,"A%i,", i - 1);
-								strcat(source_s, temp_s);
-							}
-						}
-
-						sprintf(opcode_s, "MOVEM.%c", size_arr[size]);
-						sprintmode(buf, labels, dmode, dreg, size, dest_s, &absaddr);
-						if (dir == 0) {
-							/* the comma comes from the reglist */
-							sprintf(operand_s, "%s%s", source_s, dest_s);
-						} else {
-							/* add the comma */
-							source_s[strlen(source_s)-1] = ' '; /* and remove the other one */
-							sprintf(operand_s, "%s,%s", dest_s, source_s);
-						}
-						decoded = true;
-					} break;
-					case 50 : {/* MOVEP */
-						const int dreg = (word & 0x0E00) >> 9;
-						const int areg = word & 0x0007;
-						const int size = ((word & 0x0040) >> 6) + 1;
-
-						if (size == 3) break;
-
-						const int data = getword(buf);
-						sprintf(opcode_s, "MOVEP.%c", size_arr[size]);
-						if ((word & 0x0080) == 0) {
-							/* mem -> data reg */
-							sprintf(operand_s, "$%04X(A%i),D%i", data, areg, dreg);
-						} else {
-							/* data reg -> mem */
-							sprintf(operand_s, "D%i,$%04X(A%i)", dreg, data, areg);
-						}
-						decoded = true;
-					} break;
-					case 51 : { /* MOVEQ */
-						const int dreg = (word & 0x0E00) >> 9;
-						sprintf(opcode_s, "MOVEQ");
-						sprintf(operand_s, "#$%02X,D%i", (word & 0x00FF), dreg);
-						decoded = true;
-					} break;
-					case 54 : /* NBCD */
-					case 55 :
-					case 56 :
-					case 58 : { /* NEG, NEGX + NOT */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-						if (size == 3) break;
-
-						switch(opnum) {
-							case 54 : sprintf(opcode_s, "NBCD.%c", size_arr[size]);
-								break;
-							case 55 : sprintf(opcode_s, "NEG.%c", size_arr[size]);
-								break;
-							case 56 : sprintf(opcode_s, "NEGX.%c", size_arr[size]);
-								break;
-							case 58 : sprintf(opcode_s, "NOT.%c", size_arr[size]);
-								break;
-						}
-						sprintmode(buf, labels, dmode, dreg, size, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 57 :
-					case 62 :
-					case 71 :
-					case 72 :
-					case 73 :
-					case 76 :
-					case 85 : { /* NOP, RESET, RTE, RTR, RTS, STOP, TRAPV */
-						switch(opnum) {
-							case 57 : sprintf(opcode_s, "NOP");
-								sprintf(operand_s, " ");
-								break;
-							case 62 : sprintf(opcode_s, "RESET");
-								sprintf(operand_s, " ");
-								break;
-							case 71 : sprintf(opcode_s, "RTE");
-								sprintf(operand_s, " ");
-								break;
-							case 72 : sprintf(opcode_s, "RTR");
-								sprintf(operand_s, " ");
-								break;
-							case 73 : sprintf(opcode_s, "RTS");
-								sprintf(operand_s, " ");
-								instr.isRet = 1;
-								break;
-							case 76 : sprintf(opcode_s, "STOP");
-								sprintf(operand_s, " ");
-								break;
-							case 85 : sprintf(opcode_s, "TRAPV");
-								sprintf(operand_s, " ");
-								break;
-						}
-						decoded = true;
-					} break;
-					case 61 : { /* PEA */
-						const int smode = getmode(word);
-						if (smode <= 1) break;
-						if ((smode == 3) || (smode == 4)) break;
-						if (smode >= 11) break;
-
-						sprintf(opcode_s, "PEA");
-						const int sreg = word & 0x0007;
-						sprintmode(buf, labels, smode, sreg, 0, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 75 : {/* Scc */
-						const int dmode = getmode(word);
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-
-						const int dreg = word & 0x0007;
-						const int cc = (word & 0x0F00) >> 8;
-
-						sprintf(opcode_s, "%s", scc_tab[cc]);
-						char dest_s[50];
-						sprintmode(buf, labels, dmode, dreg, 0, dest_s, &absaddr);
-						sprintf(operand_s, "%s", dest_s);
-						decoded = true;
-					} break;
-					case 82 : {/* SWAP */
-						const int dreg = word & 0x0007;
-						sprintf(opcode_s, "SWAP");
-						sprintf(operand_s, "D%i", dreg);
-						decoded = true;
-					} break;
-					case 83 : { /* TAS */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-
-						sprintf(opcode_s, "TAS ");
-						sprintmode(buf, labels, dmode, dreg, 0, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 84 : { /* TRAP */
-						const int dreg = word & 0x000F;
-						sprintf(opcode_s, "TRAP");
-						sprintf(operand_s, "%i", dreg);
-						decoded = true;
-					} break;
-					case 86 : { /* TST */
-						const int dmode = getmode(word);
-						const int dreg = word & 0x0007;
-						const int size = (word & 0x00C0) >> 6;
-
-						if (dmode == 1) break;
-						if (dmode >= 9) break;
-						if (size == 3) break;
-
-						sprintf(opcode_s, "TST ");
-						sprintmode(buf, labels, dmode, dreg, size, operand_s, &absaddr);
-						decoded = true;
-					} break;
-					case 87 : {/* UNLK */
-						const int areg = word & 0x0007;
-						sprintf(opcode_s, "UNLK");
-						sprintf(operand_s, "A%i", areg);
-						decoded = true;
-					} break;
-
-					default : gBufprintf("opnum out of range in switch (=%i)\n", opnum);
-						exit(1);
+	}
+}
+
+/*!
+	Prints operand @c op of @c in to @c out_s, with labels from @c lbls.
+*/
+static void sprintop(Decoder *d, char *out_s, Instruction *in, Operand *op, Labels *lbls) {
+	const char ir[2] = {'W','L'}; /* for mode 6 */
+	char label[MAXINSTRTEXT/2];
+
+	switch(op->kind) {
+	case OPK_EA:
+		switch(op->mode) {
+			case 0  : sprintf(out_s, "D%i", op->reg);		break;
+			case 1  : sprintf(out_s, "A%i", op->reg);		break;
+			case 2  : sprintf(out_s, "(A%i)", op->reg);		break;
+			case 3  : sprintf(out_s, "(A%i)+", op->reg);	break;
+			case 4  : sprintf(out_s, "-(A%i)", op->reg);	break;
+			case 5  : sprintf(out_s, "%+i(A%i)", op->value, op->reg);	break;
+			case 9  :
+				if (!d->rawmode) {
+					sprintlabel(label, "<%s>", lbls, op->absaddr);
+					sprintf(out_s, "%+i(PC) {$%08x%s}", op->value, op->absaddr, label);
+				} else {
+					sprintf(out_s, "%+i(PC)", op->value);
 				}
-			}
-			if (decoded) opnum = 88;
+				break;
+			case 6  : /* Areg with index + disp */
+			case 10 : {/* PC with index + disp */
+				const int data = op->index;
+				int displacement = (data & 0x00FF);
+				if (displacement >= 128) displacement -= 256;
+
+				const int ireg = (data & 0x7000) >> 12;
+				const int itype = (data & 0x8000); /* == 0 is Dreg */
+				const int isize = (data & 0x0800) >> 11; /* == 0 is .W else .L */
+
+				if (op->mode == 6) {
+					if (itype == 0) {
+						sprintf(out_s, "%+i(A%i,D%i.%c)", displacement, op->reg, ireg, ir[isize]);
+					} else {
+						sprintf(out_s, "%+i(A%i,A%i.%c)", displacement, op->reg, ireg, ir[isize]);
+					}
+				} else { /* PC */
+					if (itype == 0) {
+						sprintf(out_s, "%+i(PC,D%i.%c)", displacement, ireg, ir[isize]);
+					} else {
+						sprintf(out_s, "%+i(PC,A%i.%c)", displacement, ireg, ir[isize]);
+					}
+				}
+			} break;
+			case 7  :
+				sprintlabel(label, "<%s>", lbls, op->absaddr);
+				sprintf(out_s, "$%08x%s", op->absaddr, label);
+				break;
+			case 8  :
+				sprintlabel(label, "<%s>", lbls, op->absaddr);
+				sprintf(out_s, "$%04x%04x%s", op->absaddr >> 16, op->absaddr & 0xFFFF, label);
+				break;
+			case 11 :
+				switch(op->size) {
+					case 0 : sprintf(out_s, "#$%02x", op->value);
+						break;
+					case 1 : sprintf(out_s, "#$%04x", op->value);
+						break;
+					case 2 :
+						sprintlabel(label, "<%s>", lbls, op->absaddr);
+						sprintf(out_s, "#$%04x%04x%s", (uint32_t)op->value >> 16, op->value & 0xFFFF, label);
+						break;
+				}
+				break;
+			default : sprintf(out_s, "?"); fprintf(stderr, "Mode out of range in sprintmode = %i\n", op->mode);
+				break;
 		}
+		break;
+	case OPK_IMM:
+		switch(op->size) {
+			case 0 : sprintf(out_s, "#$%02x", (op->value & 0x00FF));
+				break;
+			case 1 : sprintf(out_s, "#$%04x", op->value);
+				break;
+			case 2 : sprintf(out_s, "#$%04x%04x", (uint32_t)op->value >> 16, op->value & 0xFFFF);
+				break;
+		}
+		break;
+	case OPK_QUICK: sprintf(out_s, "#%i", op->value);	break;
+	case OPK_MOVEQ: sprintf(out_s, "#$%02X", op->value);	break;
+	case OPK_TRAP:	sprintf(out_s, "%i", op->value);	break;
+	case OPK_LINK:	sprintf(out_s, "#%+i", op->value);	break;
+	case OPK_MOVEP: sprintf(out_s, "$%04X(A%i)", op->value, op->reg);	break;
+	case OPK_REGLIST: sprintreglist(out_s, op->value);	break;
+	case OPK_SR:	sprintf(out_s, "SR");	break;
+	case OPK_CCR:	sprintf(out_s, "CCR");	break;
+	case OPK_USP:	sprintf(out_s, "USP");	break;
+	case OPK_BRANCH:
+		if (in->mnemonic == M_DBCC) {
+			sprintf(out_s, "$%08x", op->absaddr);
+		} else if (d->rawmode) {
+			sprintf(out_s, "*%+d", op->value);
+		} else {
+			sprintlabel(label, op->size == 0 ? "(%s)" : "<%s>", lbls, op->absaddr);
+			sprintf(out_s, "$%08x%s", op->absaddr, label);
+		}
+		break;
+	default:
+		out_s[0] = 0;
+		break;
+	}
+}
 
-//		const int fetched = address - start_address;
-//		if (!rawmode) {
-//			for (int i = 0 ; i < (5 - fetched); ++i) gBufprintf("     ");
-//		}
-		if (decoded != 0) {
-			if (instr.instr) free(instr.instr);
+// Prints the mnemonic and size suffix of @c in.
+static void sprintopcode(char *opcode_s, Instruction *in) {
+	switch(in->mnemonic) {
+	case M_BCC:
+		sprintf(opcode_s, "%s", bra_tab[in->cc]);
+		break;
+	case M_DBCC:
+		if (in->cc == 0) sprintf(opcode_s, "DBT");
+		else if (in->cc == 1) sprintf(opcode_s, "DBF");
+		else sprintf(opcode_s, "D%s", bra_tab[in->cc]);
+		break;
+	case M_SCC:
+		sprintf(opcode_s, "%s", scc_tab[in->cc]);
+		break;
+	default:
+		if (in->size == NOSIZE) sprintf(opcode_s, "%s", mnemonic_tab[in->mnemonic]);
+		else sprintf(opcode_s, "%s.%c", mnemonic_tab[in->mnemonic], size_arr[in->size]);
+		break;
+	}
+}
+
+/*!
+	Formats the decoded instruction @c in as listing text into @c out, which
+	must hold MAXINSTRTEXT bytes.  Operand addresses are annotated with labels
+	from @c labels, unless @c d is in raw mode.
+*/
+void sprintinstr(Decoder *d, char *out, Instruction *in, Labels *labels) {
+	char opcode_s[16], operand_s[MAXINSTRTEXT - 16];
+	char src_s[MAXINSTRTEXT/2 - 16], dst_s[MAXINSTRTEXT/2 - 16];
+
+	sprintopcode(opcode_s, in);
+	switch(in->nops) {
+	case 0:
+		sprintf(operand_s, " ");
+		break;
+	case 1:
+		sprintop(d, operand_s, in, &in->op[0], labels);
+		break;
+	default:
+		sprintop(d, src_s, in, &in->op[0], labels);
+		sprintop(d, dst_s, in, &in->op[1], labels);
+		if (in->op[0].kind == OPK_REGLIST) {
+			/* the comma comes from the reglist */
+			sprintf(operand_s, "%s%s", src_s, dst_s);
+		} else {
+			if (in->op[1].kind == OPK_REGLIST && dst_s[0] != 0)
+				dst_s[strlen(dst_s)-1] = ' '; /* remove the reglist's trailing comma */
+			sprintf(operand_s, "%s,%s", src_s, dst_s);
+		}
+		if (in->opnum == 43) strcat(operand_s, " "); // MOVE has always been listed with a trailing blank.
+		break;
+	}
+	snprintf(out, MAXINSTRTEXT, "%-8s %s", opcode_s, operand_s);
+}
+
+// Return 0 if failed to decode instruction in the justone case
+int disasm(Decoder *d, unsigned long int start, unsigned long int end, Labels *labels, IList *output, int justone) {
+	unsigned long int addr = start;
+	while (!bufferIsEOF(d->bin, addr) && (addr < end)) {
+		Instruction instr;
+		if (decodeone(d, addr, &instr)) {
+			char opcode_s[16], asm_s[MAXINSTRTEXT];
+			sprintopcode(opcode_s, &instr);
+			sprintinstr(d, asm_s, &instr, labels);
 			instr.instr = strdup(opcode_s);
-			if (instr.asm) free(instr.asm);
-			asprintf(&instr.asm, "%-8s %s", opcode_s, operand_s);
-			instr.nbytes = address - instr.address;
-			gBufprintf("%-8s %s\n", opcode_s, operand_s);
+			instr.asm = strdup(asm_s);
+			gBufprintf("%s\n", asm_s);
 			appendInstruction(output, instr.address, instr);
+			addr += instr.nbytes;
 		} else {
 			gBufprintf("???\n");
 			if (justone) return 0;
+			addr += 2;
 		}
 		if (justone)
 			return 1;
@@ -1266,44 +1494,159 @@ int disasm(Buffer *buf, unsigned long int start, unsigned long int end, Labels *
 	return 0;
 }
 
-int disasmone(Buffer *buf, int start, Instruction *retval, Labels *labels) {
+int disasmone(Decoder *d, int start, Instruction *retval, Labels *labels) {
+	STAT(disasmone);
 	Instruction inst[2];
 	IList output = {.instrs = inst, .len=0, .cap=2}; // Should never realloc.
-	if ( disasm(buf, start, bufferEndAddress(buf), labels, &output, 1) ) {
+	if ( disasm(d, start, bufferEndAddress(d->bin), labels, &output, 1) ) {
 		*retval = inst[0];
 		return 1;
 	}
 	return 0;
 }
 
+/*
+	Control flow table.  On the 68000 the length of an instruction, and where
+	its static target lives, depend only on the first word: every addressing
+	mode's extension size is fixed by the mode and operand size fields.  So
+	for each first word we keep the length (0 for an invalid word) and how to
+	find the target, and decodeflow() needs no more than the words the target
+	is made of.
+*/
+enum FlowKind {
+	FLOW_NEXT = 0,	// falls through
+	FLOW_RET,
+	FLOW_BRA8,	// Bcc.S: displacement in the first word
+	FLOW_BRA16,	// Bcc.W, DBcc: displacement in the first extension word
+	FLOW_ABSW,	// JSR/JMP $xxxx
+	FLOW_ABSL,	// JSR/JMP $xxxxxxxx
+	FLOW_PCREL,	// JSR/JMP d16(PC)
+	FLOW_NOTARGET,	// JSR/JMP through a register
+};
+
+struct FlowEntry {
+	uint8_t nbytes;
+	uint8_t kind;	// enum FlowKind
+	uint8_t isBranch, isJump;
+};
+
+static struct FlowEntry flowtab[65536];
+static pthread_once_t flowtableonce = PTHREAD_ONCE_INIT;
+
+// Build flowtab[] by decoding every first word in front of zero extension words.
+void buildflowtable(void) {
+	Buffer *scratch = newBuffer();
+	bufferAddSection(scratch, 0, 16, "scratch");
+	unsigned char *bytes = calloc(16, 1);
+	scratch->sections[0]._bytes = bytes;
+	Decoder *d = newDecoder(scratch);
+
+	for (int word = 0; word < 65536; word++) {
+		struct FlowEntry *f = &flowtab[word];
+		Instruction in;
+		bytes[0] = word >> 8;
+		bytes[1] = word & 0xFF;
+		memset(f, 0, sizeof(*f));
+		if (!decodeone(d, 0, &in)) continue;
+
+		f->nbytes = in.nbytes;
+		f->isBranch = in.isBranch;
+		f->isJump = in.isJump;
+		if (in.isRet) {
+			f->kind = FLOW_RET;
+		} else if (in.mnemonic == M_BCC || in.mnemonic == M_DBCC) {
+			f->kind = (in.mnemonic == M_BCC && in.op[0].size == 0) ? FLOW_BRA8 : FLOW_BRA16;
+		} else if (in.isBranch || in.isJump) {
+			switch(in.op[0].mode) {
+				case 7 : f->kind = FLOW_ABSW;	break;
+				case 8 : f->kind = FLOW_ABSL;	break;
+				case 9 : f->kind = FLOW_PCREL;	break;
+				default: f->kind = FLOW_NOTARGET;	break;
+			}
+		}
+	}
+	freeDecoder(d);
+	free(bytes);
+	free(scratch->sections);
+	free(scratch);
+}
+
+// Reads as the decoder does, straight from s when it holds the word; the caller has checked for EOF.
+static inline int peekword(Buffer *b, Section *s, uint32_t addr) {
+	if (inSection(s, addr, 2)) {
+		const unsigned char *p = s->_bytes + (addr - s->_baseaddress);
+		return (p[0] << 8) | p[1];
+	}
+	return (bufferRead(b, addr) << 8) | bufferRead(b, addr + 1);
+}
+
+/*!
+	Decodes only the length and control flow of the instruction at @c start:
+	no operands, labels or text.  Agrees with decodeone() on nbytes, isBranch,
+	isJump, isRet and targetAddress.
+
+	@returns 0 if the instruction could not be decoded.
+*/
+int decodeflow(Buffer *buf, uint32_t start, Flow *retval) {
+	pthread_once(&flowtableonce, buildflowtable);
+	if (bufferIsEOF(buf, start)) return 0;
+
+	const int sn = bufferSectionByAddr(buf, start);
+	Section *s = sn < 0 ? NULL : &buf->sections[sn];
+	const int word = peekword(buf, s, start);
+	const struct FlowEntry *f = &flowtab[word];
+	if (f->nbytes == 0 || bufferIsEOF(buf, start + f->nbytes - 1)) return 0;
+
+	retval->nbytes = f->nbytes;
+	retval->isBranch = f->isBranch;
+	retval->isJump = f->isJump;
+	retval->isRet = (f->kind == FLOW_RET);
+	retval->targetAddress = 0;
+	switch(f->kind) {
+		case FLOW_BRA8 :
+			retval->targetAddress = start + 2 + (int8_t)(word & 0x00FF);
+			break;
+		case FLOW_BRA16 :
+		case FLOW_PCREL :
+			retval->targetAddress = start + 2 + (int16_t)peekword(buf, s, start + 2);
+			break;
+		case FLOW_ABSW :
+			retval->targetAddress = peekword(buf, s, start + 2);
+			break;
+		case FLOW_ABSL :
+			retval->targetAddress = ((uint32_t)peekword(buf, s, start + 2) << 16) | peekword(buf, s, start + 4);
+			break;
+	}
+	return 1;
+}
+
 
 /*!
 	Consumes end - start input bytes and outputs them as a data segment;
-	at exit the global @c address is equal to @c end.
+	at exit the @c address of @c dec is equal to @c end.
 
 	Any bytes that are within the printable character range are output as
 	those characters; full stops fill in for unprintable characters.
 	
 	returns end address written written
 */
-int datadump(Buffer *buf, uint32_t start, uint32_t end, void (*write)(char *, int addr, void *), void *d, int restrictline) {
+int datadump(Decoder *dec, uint32_t start, uint32_t end, void (*write)(char *, int addr, void *), void *d, int restrictline) {
 	int nlines = 0;
-	address = start;
-	bufferSeek(buf, start);
+	dec->address = start;
 
 	char asm[128];
-	int lineaddr = address;
+	int lineaddr = dec->address;
 	asm[0] = 0;
 	int outbuf[16];
 	char obuf[32];
 
 	// print in linesof 16 bytes
-	for(int i = (address & ~0xf); i < ((end + 0xf)&~0xf); i++) {
+	for(uint32_t i = (dec->address & ~0xf); i < ((end + 0xf)&~0xf); i++) {
 		if (i < start || i >= end) {
 			strcat(asm, " ");
 			outbuf[i%16] = -1;
 		} else {
-			int byte = getbyte(buf);
+			int byte = getbyte(dec);
 			outbuf[i%16] = byte;
 			 if (isprint(byte)) {
 				char s[2];
@@ -1330,27 +1673,8 @@ int datadump(Buffer *buf, uint32_t start, uint32_t end, void (*write)(char *, in
 				return i > end ? end : i+1;
 			asm[0] = 0;
 			nlines++;
-			lineaddr = address;
+			lineaddr = dec->address;
 		}
 	}
 	return end;
 }
-
-void addinstr(char *s, int addr, void *d) {
-	IList *instrs = (IList *)d;
-	Instruction inst = {.asm=s, .address=addr};
-	appendInstruction(instrs, addr, inst);
-}
-
-int rundis(Buffer *bin, BasicBlock *blocks, int nblocks, Labels *labels, IList *instrs) {
-	bufferSeek(bin, 0);
-	address = 0;
-	romstart = 0;
-
-	for(int i = 0; i < nblocks; i++) {
-		if (blocks[i].isdata) datadump(bin, blocks[i].begin, blocks[i].end, addinstr, instrs, -1);
-		else disasm(bin, blocks[i].begin, blocks[i].end, labels, instrs, 0);
-	}
-	return 0;
-}
-
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dat.h"
+
+// Decoded-instruction cache, keyed by address.  An instruction's decoding
+// depends only on the bytes of the buffer, never on labels, so entries stay
+// valid for the life of the buffer.
+//
+// Each section has a direct map with one slot per word, holding the index
+// of the entry (plus one) or 0.  Entries live in pages that never move.
+// Readers take no lock: a slot is published only after its entry is
+// written.  Writers serialise on one mutex.  Hit and miss counts are kept
+// in the Decoder, so threads do not share a counter; freeDecoder() adds
+// them to the cache's totals.
+
+#define PAGESHIFT 12
+#define PAGESIZE (1 << PAGESHIFT)
+
+typedef struct {
+	int ok; // decodeone() result
+	Instruction in;
+} ICacheEntry;
+
+struct ICache {
+	Buffer *bin;
+	uint32_t **maps; // per section, one slot per word
+	ICacheEntry **pages;
+	int npages;
+	int len; // entries in use
+	pthread_mutex_t lock;
+	long hits, misses; // from freed Decoders
+};
+
+// The sections must all have been added.
+ICache *newICache(Buffer *bin) {
+	ICache *c = malloc(sizeof(ICache));
+	c->bin = bin;
+	c->maps = malloc(sizeof(uint32_t *) * bin->len);
+	long words = 0;
+	for(int i = 0; i < bin->len; i++) {
+		c->maps[i] = calloc(bin->sections[i]._len / 2 + 1, sizeof(uint32_t));
+		words += bin->sections[i]._len / 2 + 1;
+	}
+	c->npages = (words + PAGESIZE - 1) / PAGESIZE;
+	c->pages = calloc(c->npages, sizeof(ICacheEntry *));
+	c->len = 0;
+	pthread_mutex_init(&c->lock, NULL);
+	c->hits = c->misses = 0;
+	return c;
+}
+
+void freeICache(ICache *c) {
+	for(int i = 0; i < c->bin->len; i++)
+		free(c->maps[i]);
+	for(int i = 0; i < c->npages; i++)
+		free(c->pages[i]);
+	free(c->maps);
+	free(c->pages);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+// The slot for the word at addr of section sec, or NULL if it has none.
+static uint32_t *icacheslot(ICache *c, int sec, int addr) {
+	Section *s = &c->bin->sections[sec];
+	int off = addr - s->_baseaddress;
+	if ((addr & 1) || off < 0 || off >= (int)s->_len) return NULL;
+	return &c->maps[sec][off / 2];
+}
+
+// Copies the cached decoding of addr, in section sec, into out and sets ok; returns 0 on a miss.
+int icacheLookup(ICache *c, int sec, int addr, Instruction *out, int *ok) {
+	uint32_t *slot = icacheslot(c, sec, addr);
+	if (slot == NULL) return 0;
+	uint32_t i = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (i == 0) return 0;
+	i--;
+	ICacheEntry *e = &c->pages[i >> PAGESHIFT][i & (PAGESIZE - 1)];
+	*out = e->in;
+	*ok = e->ok;
+	return 1;
+}
+
+void icacheInsert(ICache *c, int sec, int addr, Instruction *in, int ok) {
+	uint32_t *slot = icacheslot(c, sec, addr);
+	if (slot == NULL) return;
+	pthread_mutex_lock(&c->lock);
+	if (*slot == 0) {
+		int i = c->len++;
+		if (c->pages[i >> PAGESHIFT] == NULL)
+			c->pages[i >> PAGESHIFT] = malloc(sizeof(ICacheEntry) * PAGESIZE);
+		ICacheEntry *e = &c->pages[i >> PAGESHIFT][i & (PAGESIZE - 1)];
+		e->ok = ok;
+		e->in = *in;
+		e->in.asm = e->in.instr = NULL; // Text belongs to the caller.
+		__atomic_store_n(slot, i + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+// Adds a Decoder's counts to the totals.
+void icacheCount(ICache *c, long hits, long misses) {
+	pthread_mutex_lock(&c->lock);
+	c->hits += hits;
+	c->misses += misses;
+	pthread_mutex_unlock(&c->lock);
+}
+
+void icacheStats(ICache *c, long *hits, long *misses, long *entries) {
+	pthread_mutex_lock(&c->lock);
+	*hits = c->hits;
+	*misses = c->misses;
+	*entries = c->len;
+	pthread_mutex_unlock(&c->lock);
+}
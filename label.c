@@ -1,5 +1,7 @@
+#define _POSIX_C_SOURCE 200809L // strdup, strndup
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include "dat.h"
 
@@ -20,33 +22,173 @@ int searchLabelsByAddr(Labels *labels, int key) {
 	return l;
 }
 
+static unsigned int labelhash(int addr) {
+	return (unsigned int)addr * 2654435761u;
+}
+
+// The slot holding addr, or the empty slot where it belongs.
+static LabelSlot *labelslot(Labels *ls, int addr) {
+	unsigned int mask = ls->hashcap - 1;
+	for(unsigned int i = labelhash(addr) & mask; ; i = (i + 1) & mask) {
+		if (ls->byaddr[i].idx == -1 || ls->byaddr[i].addr == addr)
+			return &ls->byaddr[i];
+	}
+}
+
+// Rebuilds the address index with room for cap labels.
+static void rehashLabels(Labels *ls, int cap) {
+	int hashcap = 16;
+	while (hashcap < 2 * cap) hashcap *= 2;
+	free(ls->byaddr);
+	ls->byaddr = (LabelSlot *)malloc(sizeof(LabelSlot) * hashcap);
+	ls->hashcap = hashcap;
+	for(int i = 0; i < hashcap; i++)
+		ls->byaddr[i].idx = -1;
+	for(int i = 0; i < ls->len; i++)
+		*labelslot(ls, ls->labels[i].addr) = (LabelSlot){ls->labels[i].addr, i};
+}
+
+// An index entry may lag behind: inserting a label moves the ones after
+// it up without touching their entries.  A stale entry is found by binary
+// search and fixed, so lookups are O(1) once labels stop changing.  Lookups
+// may run on several threads; the fix is the same on each.
 int findLabelByAddr(Labels *labels, int key) {
+	STAT(findlabel);
 	if (labels->len == 0) return -1;
-	int pos = searchLabelsByAddr(labels, key);
-	if (pos >= labels->len || labels->labels[pos].addr != key) return -1;
-	return pos;
+	LabelSlot *s = labelslot(labels, key);
+	int idx = __atomic_load_n(&s->idx, __ATOMIC_RELAXED);
+	if (idx == -1) return -1;
+	if (idx < labels->len && labels->labels[idx].addr == key) return idx;
+	idx = searchLabelsByAddr(labels, key);
+	__atomic_store_n(&s->idx, idx, __ATOMIC_RELAXED);
+	return idx;
+}
+
+enum {
+	NAMEFREE = 0,
+	NAMEUSED,
+	NAMEGONE, // deleted; probes continue past it
+};
+
+static unsigned int namehash(char *s) {
+	unsigned int h = 2166136261u; // FNV-1a
+	for(; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+// Rebuilds the name index with room for cap labels.
+static void rehashNames(Labels *ls, int cap) {
+	int namecap = 16;
+	while (namecap < 2 * cap) namecap *= 2;
+	free(ls->byname);
+	ls->byname = (NameSlot *)calloc(namecap, sizeof(NameSlot));
+	ls->namecap = namecap;
+	ls->nnameslots = 0;
+	for(int i = 0; i < ls->len; i++) {
+		unsigned int h = namehash(ls->labels[i].name);
+		unsigned int j = h & (namecap - 1);
+		while (ls->byname[j].state != NAMEFREE) j = (j + 1) & (namecap - 1);
+		ls->byname[j] = (NameSlot){h, ls->labels[i].addr, NAMEUSED};
+		ls->nnameslots++;
+	}
+}
+
+static void addName(Labels *ls, char *name, int addr) {
+	if (2 * (ls->nnameslots + 1) > ls->namecap) {
+		rehashNames(ls, ls->len); // The label is already in the array.
+		return;
+	}
+	unsigned int h = namehash(name);
+	unsigned int j = h & (ls->namecap - 1);
+	while (ls->byname[j].state == NAMEUSED) j = (j + 1) & (ls->namecap - 1);
+	if (ls->byname[j].state == NAMEFREE) ls->nnameslots++;
+	ls->byname[j] = (NameSlot){h, addr, NAMEUSED};
 }
 
+static void removeName(Labels *ls, char *name, int addr) {
+	unsigned int h = namehash(name);
+	for(unsigned int j = h & (ls->namecap - 1); ls->byname[j].state != NAMEFREE; j = (j + 1) & (ls->namecap - 1)) {
+		if (ls->byname[j].state == NAMEUSED && ls->byname[j].addr == addr) {
+			ls->byname[j].state = NAMEGONE;
+			return;
+		}
+	}
+}
+
+// Names need not be unique; like a scan of the array, return the lowest address.
 int findLabelByName(Labels *labels, char *key) {
-	for(int i=0; i < labels->len; i++) {
-		if (strcmp(labels->labels[i].name, key) == 0)
-			return i;
+	unsigned int h = namehash(key);
+	int best = -1;
+	for(unsigned int j = h & (labels->namecap - 1); labels->byname[j].state != NAMEFREE; j = (j + 1) & (labels->namecap - 1)) {
+		NameSlot *s = &labels->byname[j];
+		if (s->state != NAMEUSED || s->hash != h) continue;
+		int idx = findLabelByAddr(labels, s->addr);
+		if (idx != -1 && strcmp(labels->labels[idx].name, key) == 0 && (best == -1 || idx < best))
+			best = idx;
 	}
-	return -1;
+	return best;
+}
+
+static int bynamecmp(const void *a, const void *b) {
+	const Label *la = (const Label *)a, *lb = (const Label *)b;
+	int c = strcmp(la->name, lb->name);
+	if (c != 0) return c;
+	return la->addr < lb->addr ? -1 : la->addr > lb->addr;
+}
+
+/*
+	Returns the index of the first label, in name order, whose name starts
+	with prefix, and sets nmatches to the number that do.  The name order is
+	sorted again on the first call after the labels change.
+*/
+int findLabelByPrefix(Labels *labels, char *prefix, int *nmatches) {
+	if (labels->byprefix == NULL) {
+		labels->byprefix = (Label *)malloc(sizeof(Label) * (labels->len + 1));
+		memcpy(labels->byprefix, labels->labels, sizeof(Label) * labels->len);
+		qsort(labels->byprefix, labels->len, sizeof(Label), bynamecmp);
+	}
+	Label *sorted = labels->byprefix;
+	size_t n = strlen(prefix);
+	int l = 0, r = labels->len;
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (strncmp(sorted[m].name, prefix, n) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+	int first = l;
+	r = labels->len;
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if (strncmp(sorted[m].name, prefix, n) <= 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+	*nmatches = l - first;
+	if (*nmatches == 0) return -1;
+	return findLabelByAddr(labels, sorted[first].addr);
 }
 
 void insertLabel(Labels *ls, int pos, struct Label newvalue)
 {
+	free(ls->byprefix); // Name order is stale.
+	ls->byprefix = NULL;
+
 	// Renaming the existing label.
 	if (pos < ls->len && ls->labels[pos].addr == newvalue.addr) {
+		removeName(ls, ls->labels[pos].name, newvalue.addr);
 		free(ls->labels[pos].name);
 		ls->labels[pos] = newvalue;
+		addName(ls, newvalue.name, newvalue.addr);
 		return;
 	}
 	
 	// Label ins't a match.  Insert at this position. That means increasing the length by one
 	int i;
 	if (ls->len == ls->cap) {
+		STAT(labelgrows);
 		ls->cap = ls->cap * 2;
 		Label *nl = (Label*)realloc(ls->labels, sizeof(Label) * ls->cap);
 		if (nl == NULL) {
@@ -58,6 +200,13 @@ void insertLabel(Labels *ls, int pos, struct Label newvalue)
 		ls->labels[i] = ls->labels[i - 1];
 	ls->len++;
 	ls->labels[pos] = newvalue;
+
+	// The entries of the labels after pos are now stale; findLabelByAddr() fixes them.
+	if (2 * ls->len > ls->hashcap)
+		rehashLabels(ls, ls->len);
+	else
+		*labelslot(ls, newvalue.addr) = (LabelSlot){newvalue.addr, pos};
+	addName(ls, newvalue.name, newvalue.addr);
 }
 
 Labels *newLabels(int cap) {
@@ -65,6 +214,11 @@ Labels *newLabels(int cap) {
 	l->labels = (Label *)malloc(sizeof( Label ) * cap );
 	l->cap = cap;
 	l->len = 0;
+	l->byaddr = NULL;
+	l->byname = NULL;
+	l->byprefix = NULL;
+	rehashLabels(l, cap);
+	rehashNames(l, cap);
 	return l;
 }
 
@@ -75,17 +229,156 @@ void addLabel(Labels *ls, char *name, int addr, int generated) {
 	insertLabel(ls, ipos, l);
 }
 
+// Empties addr's slot, moving later entries of its probe run back so none is cut off.
+static void unhashLabel(Labels *ls, int addr) {
+	unsigned int mask = ls->hashcap - 1;
+	LabelSlot *s = labelslot(ls, addr);
+	if (s->idx == -1) return;
+	unsigned int i = s - ls->byaddr;
+	for(unsigned int j = (i + 1) & mask; ls->byaddr[j].idx != -1; j = (j + 1) & mask) {
+		unsigned int home = labelhash(ls->byaddr[j].addr) & mask;
+		// Entry j may fill the hole unless its home lies cyclically in (i, j].
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			ls->byaddr[i] = ls->byaddr[j];
+			i = j;
+		}
+	}
+	ls->byaddr[i].idx = -1;
+}
+
+// Deletes the label at addr, if there is one.
+void deleteLabel(Labels *ls, int addr) {
+	int pos = findLabelByAddr(ls, addr);
+	if (pos == -1) return;
+	free(ls->byprefix);
+	ls->byprefix = NULL;
+	removeName(ls, ls->labels[pos].name, addr);
+	unhashLabel(ls, addr);
+	free(ls->labels[pos].name);
+	memmove(&ls->labels[pos], &ls->labels[pos+1], sizeof(Label) * (ls->len - pos - 1));
+	ls->len--;
+	// As after an insert, the entries of the labels after pos are stale.
+}
+
+typedef struct {
+	Label l;
+	int seq; // position in the input, to order duplicates
+} Pending;
+
+static int pendingcmp(const void *a, const void *b) {
+	const Pending *pa = (const Pending *)a, *pb = (const Pending *)b;
+	if (pa->l.addr != pb->l.addr) return pa->l.addr < pb->l.addr ? -1 : 1;
+	return pa->seq - pb->seq;
+}
+
+/*
+	Adds n labels in one pass, in any order, taking ownership of their names.
+	Where a label already has the address, the new one replaces it if replace
+	is set, as addLabel() does, and is dropped otherwise.  Within add, the last
+	of a duplicated address wins if replace is set, the first otherwise.
+*/
+void mergeLabels(Labels *ls, Label *add, int n, int replace) {
+	Pending *p = (Pending *)malloc(sizeof(Pending) * (n + 1));
+	for(int i = 0; i < n; i++)
+		p[i] = (Pending){add[i], i};
+	qsort(p, n, sizeof(Pending), pendingcmp);
+
+	int m = 0;
+	for(int i = 0; i < n; i++) {
+		if (m > 0 && p[m-1].l.addr == p[i].l.addr) {
+			if (replace) {
+				free(p[m-1].l.name);
+				p[m-1] = p[i];
+			} else {
+				free(p[i].l.name);
+			}
+		} else {
+			p[m++] = p[i];
+		}
+	}
+
+	int cap = ls->len + m > 1 ? ls->len + m : 1;
+	Label *out = (Label *)malloc(sizeof(Label) * cap);
+	int i = 0, j = 0, k = 0;
+	while (i < ls->len || j < m) {
+		if (j == m || (i < ls->len && ls->labels[i].addr < p[j].l.addr)) {
+			out[k++] = ls->labels[i++];
+		} else if (i == ls->len || p[j].l.addr < ls->labels[i].addr) {
+			out[k++] = p[j++].l;
+		} else if (replace) {
+			free(ls->labels[i++].name);
+			out[k++] = p[j++].l;
+		} else {
+			free(p[j++].l.name);
+			out[k++] = ls->labels[i++];
+		}
+	}
+	free(p);
+	free(ls->labels);
+	ls->labels = out;
+	ls->len = k;
+	ls->cap = cap;
+
+	free(ls->byprefix);
+	ls->byprefix = NULL;
+	rehashLabels(ls, ls->len);
+	rehashNames(ls, ls->len);
+}
+
+// Only generate labels if there isn't already a label for that address.
+// Add them as auto-generated so they don't get saved and restored.
+void generateLabels(Labels *l, BasicBlock *blocks, int nblocks) {
+	Label *gen = malloc(sizeof(Label) * (nblocks + 1));
+	int n = 0;
+	for(int i = 0; i < nblocks; i++) {
+		if (findLabelByAddr(l, blocks[i].begin) == -1) {
+			char buf[128];
+			sprintf(buf, "L%06x", blocks[i].begin);
+			gen[n++] = (Label){.name = strdup(buf), .addr = blocks[i].begin, .generated = 1};
+		}
+	}
+	mergeLabels(l, gen, n, 0);
+	free(gen);
+}
+
+// Reads "<hex address> <name>" lines, all at once.  Lines that don't parse are skipped.
 void freadLabels(FILE *fp, Labels *labels) {
-	size_t nread;
-	char *line = 0;
-	size_t size = 0;
-	while ((nread = getline(&line, &size, fp)) != -1) {
-		line[nread-1] = 0; // Ditch the newline
-		int addr;
-		char name[128];
-		sscanf(line, "%x %s", &addr, name);
-		addLabel(labels, name, addr, 0);
-         }
+	size_t size = 0, cap = 65536, n;
+	char *text = (char *)malloc(cap + 1);
+	while ((n = fread(text + size, 1, cap - size, fp)) > 0) {
+		size += n;
+		if (size == cap) {
+			cap *= 2;
+			text = (char *)realloc(text, cap + 1);
+		}
+	}
+	text[size] = 0;
+
+	int nadd = 0, addcap = 1024;
+	Label *add = (Label *)malloc(sizeof(Label) * addcap);
+	for(char *line = text; line < text + size; ) {
+		char *eol = strchr(line, '\n');
+		if (eol == NULL) eol = text + size;
+		*eol = 0;
+
+		char *end;
+		unsigned long addr = strtoul(line, &end, 16);
+		if (end != line) {
+			char *name = end + strspn(end, " \t");
+			size_t len = strcspn(name, " \t\r");
+			if (len > 0) {
+				if (nadd == addcap) {
+					addcap *= 2;
+					add = (Label *)realloc(add, sizeof(Label) * addcap);
+				}
+				add[nadd++] = (Label){.name = strndup(name, len), .addr = (int)addr, .generated = 0};
+			}
+		}
+		line = eol + 1;
+	}
+	free(text);
+	mergeLabels(labels, add, nadd, 1);
+	free(add);
 }
 
 IList *newIList(void) {
@@ -112,6 +405,7 @@ void freeIList(IList *l) {
 	
 void appendInstruction(IList *l, int addr, Instruction instr) {
 	if (l->len+1 >= l->cap) {
+		STAT(ilistgrows);
 		l->cap *= 2;
 		l->instrs = (Instruction *)realloc(l->instrs, sizeof(Instruction)*l->cap);
 	}
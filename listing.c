@@ -0,0 +1,234 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dat.h"
+
+// Listing generation.  The address space is cut into chunks at block
+// boundaries, and big data blocks at 16 byte line boundaries, so that the
+// text of a chunk does not depend on its neighbours.  Workers format chunks
+// in address order into private buffers, each with its own Decoder, and the
+// calling thread emits them in the same order: the result is identical to a
+// serial walk over the blocks.  Workers run at most a window of chunks ahead
+// of the one being emitted, so only that many buffers are held at once.
+
+#define CHUNKSPERTHREAD 8
+#define MINCHUNKLINES 4096
+#define WINDOWPERTHREAD 2 // Chunks in flight per thread
+
+int listingthreads(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+}
+
+void myfprint(char *s, int addr, void *d) {
+	DumpOut *o = (DumpOut *)d;
+	fprintf(o->fp, "%06x", addr);
+	for(int i=0;i<o->ntab;i++) fprintf(o->fp,"\t");
+	fprintf(o->fp, "%s", s);
+	o->ntab = 4; // Cheesy "use fewer tabs on each start"
+}
+
+// A chunk boundary: block and the address in it where the chunk starts.
+typedef struct {
+	int block;
+	int addr;
+} Cut;
+
+// Fills bounds with nchunks+1 chunk boundaries; returns nchunks.
+static int planchunks(BasicBlock *blocks, int nblocks, int nthreads, Cut **bounds) {
+	long total = 0;
+	for(int i = 0; i < nblocks; i++)
+		total += blocks[i].isdata ? blocks[i].nlines : blocks[i].ninstr;
+	long target = total / ((long)nthreads * CHUNKSPERTHREAD);
+	if (target < MINCHUNKLINES) target = MINCHUNKLINES;
+
+	int cap = 16, n = 0;
+	Cut *b = malloc(sizeof(Cut) * cap);
+	long lines = 0;
+	for(int i = 0; i < nblocks; i++) {
+		if (lines >= target || n == 0) {
+			b[n++] = (Cut){i, blocks[i].begin};
+			lines = 0;
+		}
+		if (n + 1 >= cap) {
+			cap *= 2;
+			b = realloc(b, sizeof(Cut) * cap);
+		}
+		if (!blocks[i].isdata) {
+			lines += blocks[i].ninstr;
+			continue;
+		}
+		// Cut a data block on line boundaries wherever the chunk fills up.
+		int at = blocks[i].begin;
+		while (lines + (blocks[i].end - at + 15) / 16 > target) {
+			int cut = ((at & ~0xf) + (target - lines) * 16);
+			if (cut <= at || cut >= blocks[i].end) break;
+			at = cut;
+			b[n++] = (Cut){i, at};
+			lines = 0;
+			if (n + 1 >= cap) {
+				cap *= 2;
+				b = realloc(b, sizeof(Cut) * cap);
+			}
+		}
+		lines += (blocks[i].end - at + 15) / 16;
+	}
+	b[n] = (Cut){nblocks, 0};
+	*bounds = b;
+	return n;
+}
+
+// Does the chunk ending at to take in part of block i?
+static int inchunk(BasicBlock *blocks, int i, Cut to) {
+	return i < to.block || (i == to.block && to.addr > blocks[i].begin);
+}
+
+// Writes the listing from one boundary to the next to fp.
+static void listrange(FILE *fp, Decoder *dec, Labels *labels, BasicBlock *blocks, Cut begin, Cut end) {
+	Instruction instr;
+	int l;
+	for(int i = begin.block; inchunk(blocks, i, end); i++) {
+		if (blocks[i].isdata) {
+			int from = i == begin.block ? begin.addr : blocks[i].begin;
+			int to = i == end.block ? end.addr : blocks[i].end;
+			DumpOut o = {.fp = fp, .ntab = 4}; // A continued block has no label.
+			if (from == blocks[i].begin) {
+				if ((l = findLabelByAddr(labels, from)) != -1) {
+					fprintf(fp, "%16s: ", labels->labels[l].name);
+				} else {
+					fprintf(fp, "%08x\t", from);
+				}
+				o.ntab = 2;
+			}
+			datadump(dec, from, to, myfprint, &o, -1);
+			continue;
+		}
+		for(int addr = blocks[i].begin; addr < blocks[i].end; ) {
+			if ((l = findLabelByAddr(labels, addr)) != -1) {
+//				fprintf(fp, "%08x", addr);
+				fprintf(fp, "%16s: ", labels->labels[l].name);
+			} else {
+				fprintf(fp, "%08x\t", addr);
+			}
+			char asm_s[MAXINSTRTEXT];
+			decodeone(dec, addr, &instr);
+			sprintinstr(dec, asm_s, &instr, labels);
+			fprintf(fp, "\t\t%s\n", asm_s);
+			addr += instr.nbytes;
+		}
+	}
+}
+
+typedef struct Chunk {
+	char *text;
+	size_t len;
+	int done;
+} Chunk;
+
+typedef struct {
+	Buffer *bin;
+	BasicBlock *blocks;
+	int nblocks;
+	Labels *labels;
+	Cut *bounds;
+	Chunk *chunks;
+	int nchunks;
+	int next;	// next chunk to hand out
+	int emitted;	// chunks written so far
+	int window;	// most chunks handed out and not yet written
+	pthread_mutex_t lock;
+	pthread_cond_t ready;	// a chunk is done
+	pthread_cond_t room;	// a chunk is written
+} Job;
+
+static void formatchunk(Job *job, Decoder *dec, int c) {
+	Chunk *ch = &job->chunks[c];
+	FILE *fp = open_memstream(&ch->text, &ch->len);
+	listrange(fp, dec, job->labels, job->blocks, job->bounds[c], job->bounds[c+1]);
+	fclose(fp);
+}
+
+static void *worker(void *arg) {
+	Job *job = (Job *)arg;
+	Decoder *dec = newDecoder(job->bin);
+	for(;;) {
+		pthread_mutex_lock(&job->lock);
+		while (job->next < job->nchunks && job->next - job->emitted >= job->window)
+			pthread_cond_wait(&job->room, &job->lock);
+		int c = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (c >= job->nchunks) break;
+
+		formatchunk(job, dec, c);
+
+		pthread_mutex_lock(&job->lock);
+		job->chunks[c].done = 1;
+		pthread_cond_broadcast(&job->ready);
+		pthread_mutex_unlock(&job->lock);
+	}
+	freeDecoder(dec);
+	return NULL;
+}
+
+// Formats every chunk on nthreads workers and hands them to emit in address order.
+static void runjob(Job *job, int nthreads, void (*emit)(Chunk *, void *), void *d) {
+	job->nchunks = planchunks(job->blocks, job->nblocks, nthreads, &job->bounds);
+	job->chunks = calloc(job->nchunks, sizeof(Chunk));
+	job->next = 0;
+	job->emitted = 0;
+	job->window = WINDOWPERTHREAD * nthreads;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->ready, NULL);
+	pthread_cond_init(&job->room, NULL);
+
+	pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+	for(int t = 0; t < nthreads; t++)
+		pthread_create(&threads[t], NULL, worker, job);
+
+	for(int c = 0; c < job->nchunks; c++) {
+		pthread_mutex_lock(&job->lock);
+		while (!job->chunks[c].done)
+			pthread_cond_wait(&job->ready, &job->lock);
+		pthread_mutex_unlock(&job->lock);
+		emit(&job->chunks[c], d);
+
+		pthread_mutex_lock(&job->lock);
+		job->emitted = c + 1;
+		pthread_cond_broadcast(&job->room);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	for(int t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	pthread_cond_destroy(&job->room);
+	pthread_cond_destroy(&job->ready);
+	pthread_mutex_destroy(&job->lock);
+	free(job->chunks);
+	free(job->bounds);
+}
+
+static void emittext(Chunk *ch, void *d) {
+	fwrite(ch->text, 1, ch->len, (FILE *)d);
+	free(ch->text);
+}
+
+/*
+	Writes the listing of all blocks to fp, using nthreads threads; 0 means
+	one per processor, 1 writes directly without buffering.
+*/
+void writelisting(FILE *fp, Buffer *bin, BasicBlock *blocks, int nblocks, Labels *labels, int nthreads) {
+	if (nblocks == 0) return;
+	if (nthreads <= 0) nthreads = listingthreads();
+	if (nthreads == 1) {
+		Decoder *dec = newDecoder(bin);
+		listrange(fp, dec, labels, blocks, (Cut){0, blocks[0].begin}, (Cut){nblocks, 0});
+		freeDecoder(dec);
+		return;
+	}
+	Job job = {.bin = bin, .blocks = blocks, .nblocks = nblocks, .labels = labels};
+	runjob(&job, nthreads, emittext, fp);
+}
@@ -0,0 +1,311 @@
+/*
+	Runs every one of the 65536 first words through a decoder, each in front
+	of a few patterns of extension words, and records what it makes of them:
+	whether it decodes, the length, the control flow and the text.
+
+		dis-opcheck [-p path] [-g golden] [-c golden] [-T times]
+
+	-g writes the records to a golden file; -c compares them with one written
+	earlier, printing the differences, and exits 1 if there are any.  The
+	path is the decoder to run: disasm (the default, as the listing decodes),
+	scan (a linear scan of optab) or flow (decodeflow(), which has no text).
+	A path is compared on the parts of the record it makes.  A new decoder
+	goes in paths[], and is checked against a golden file made before it.
+
+	opcodes.golden.gz, which `make opcheck` compares every path with, is not
+	from this decoder.  It holds the records of the original one in
+	dis68k.c, which tried each first word against optab in turn and had no
+	tables, run over the same words and patterns.  Records from the decoder
+	as it is now would only show that it agrees with itself.  A change meant
+	to alter what the decoder makes replaces the file, and says so.
+
+	Either way, the time each word takes to decode is reported by optab
+	entry, slowest first, and with -T written out word by word.
+*/
+#define _POSIX_C_SOURCE 200809L // getopt
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dat.h"
+
+#define BASE 0x1000 // Where the instruction is decoded, so PC relative targets are not 0.
+#define NEXT 5 // Extension words after the first; more than any instruction has.
+#define REPS 5 // Timings are the best of this many.
+#define NOPNUMS 88
+#define MAXDIFFS 20 // Differences printed
+
+enum {
+	FLENGTH = 1, // nbytes
+	FFLOW = 2, // isBranch, isJump, isRet, target
+	FTEXT = 4,
+};
+
+typedef struct {
+	int ok, nbytes, isBranch, isJump, isRet;
+	unsigned target;
+	char text[MAXINSTRTEXT];
+} Record;
+
+typedef struct {
+	char *name;
+	int fields; // What decode fills in
+	int (*decode)(Decoder *d, Labels *labels, Record *r);
+} Path;
+
+// Extension word patterns: zero, small and positive, all ones, and the sign edges.
+static const uint16_t exts[][NEXT] = {
+	{0x0000, 0x0000, 0x0000, 0x0000, 0x0000},
+	{0x1234, 0x5678, 0x9abc, 0xdef0, 0x1357},
+	{0xffff, 0xffff, 0xffff, 0xffff, 0xffff},
+	{0x8000, 0x7ffe, 0x0100, 0x00ff, 0x4000},
+};
+#define NPATTERNS (int)(sizeof(exts) / sizeof(exts[0]))
+
+void panic(char *s, ...) {
+	va_list args;
+	va_start(args, s);
+	vfprintf(stderr, s, args);
+	va_end(args);
+	exit(1);
+}
+
+static void fromInstruction(Record *r, Instruction *in) {
+	r->nbytes = in->nbytes;
+	r->isBranch = in->isBranch;
+	r->isJump = in->isJump;
+	r->isRet = in->isRet;
+	r->target = in->targetAddress;
+}
+
+static int viadisasm(Decoder *d, Labels *labels, Record *r) {
+	Instruction in;
+	if (!disasmone(d, BASE, &in, labels))
+		return 0;
+	fromInstruction(r, &in);
+	snprintf(r->text, sizeof(r->text), "%s", in.asm);
+	free(in.asm);
+	free(in.instr);
+	return 1;
+}
+
+static int viascan(Decoder *d, Labels *labels, Record *r) {
+	Instruction in;
+	if (!decodescan(d, BASE, &in))
+		return 0;
+	fromInstruction(r, &in);
+	sprintinstr(d, r->text, &in, labels);
+	return 1;
+}
+
+static int viaflow(Decoder *d, Labels *labels, Record *r) {
+	Flow f;
+	(void)labels;
+	if (!decodeflow(d->bin, BASE, &f))
+		return 0;
+	r->nbytes = f.nbytes;
+	r->isBranch = f.isBranch;
+	r->isJump = f.isJump;
+	r->isRet = f.isRet;
+	r->target = f.targetAddress;
+	return 1;
+}
+
+static Path paths[] = {
+	{"disasm", FLENGTH|FFLOW|FTEXT, viadisasm},
+	{"scan", FLENGTH|FFLOW|FTEXT, viascan},
+	{"flow", FLENGTH|FFLOW, viaflow},
+};
+
+static unsigned char *bytes;
+
+// Puts word and extension pattern p at BASE.
+static void place(int word, int p) {
+	bytes[0] = word >> 8;
+	bytes[1] = word;
+	for(int i = 0; i < NEXT; i++) {
+		bytes[2 + 2*i] = exts[p][i] >> 8;
+		bytes[3 + 2*i] = exts[p][i];
+	}
+}
+
+static int decode(Path *path, Decoder *d, Labels *labels, Record *r) {
+	memset(r, 0, sizeof(*r));
+	r->ok = path->decode(d, labels, r);
+	if (!r->ok)
+		memset(r, 0, sizeof(*r));
+	return r->ok;
+}
+
+static void writerecord(FILE *fp, unsigned word, int p, Record *r) {
+	fprintf(fp, "%04x %d %d %d %d %d %d %x\t%s\n", word, p, r->ok, r->nbytes,
+		r->isBranch, r->isJump, r->isRet, r->target, r->text);
+}
+
+static int readrecord(FILE *fp, unsigned *word, int *p, Record *r) {
+	char line[64 + MAXINSTRTEXT];
+	if (fgets(line, sizeof(line), fp) == NULL)
+		return 0;
+	memset(r, 0, sizeof(*r));
+	if (sscanf(line, "%x %d %d %d %d %d %d %x", word, p, &r->ok, &r->nbytes,
+	    &r->isBranch, &r->isJump, &r->isRet, &r->target) != 8)
+		return -1;
+	char *tab = strchr(line, '\t');
+	if (tab != NULL) {
+		tab[strcspn(tab, "\n")] = 0;
+		snprintf(r->text, sizeof(r->text), "%s", tab + 1);
+	}
+	return 1;
+}
+
+// Whether a and b agree on the given fields.
+static int same(Record *a, Record *b, int fields) {
+	if (a->ok != b->ok) return 0;
+	if ((fields & FLENGTH) && a->nbytes != b->nbytes) return 0;
+	if ((fields & FFLOW) && (a->isBranch != b->isBranch || a->isJump != b->isJump ||
+	    a->isRet != b->isRet || a->target != b->target)) return 0;
+	if ((fields & FTEXT) && strcmp(a->text, b->text) != 0) return 0;
+	return 1;
+}
+
+typedef struct {
+	int opnum;
+	int nwords;
+	double total, max; // ns
+	char names[64]; // The mnemonics it decodes to
+} Group;
+
+static int slowest(const void *a, const void *b) {
+	const Group *x = a, *y = b;
+	double mx = x->nwords ? x->total / x->nwords : 0, my = y->nwords ? y->total / y->nwords : 0;
+	return mx < my ? 1 : mx > my ? -1 : 0;
+}
+
+// Adds the mnemonic of in, without its size, to the group's names, once.
+static void addname(Group *g, Instruction *in) {
+	char s[16];
+	snprintf(s, sizeof(s), "%s", in->instr);
+	s[strcspn(s, ". ")] = 0;
+	char *p = g->names;
+	int len = strlen(s);
+	while ((p = strstr(p, s)) != NULL) {
+		if ((p == g->names || p[-1] == ' ') && (p[len] == 0 || p[len] == ' '))
+			return;
+		p += len;
+	}
+	if (strlen(g->names) + len + 2 < sizeof(g->names))
+		sprintf(g->names + strlen(g->names), "%s%s", g->names[0] ? " " : "", s);
+}
+
+int main(int argc, char **argv) {
+	char *goldname = NULL, *cmpname = NULL, *timesname = NULL, *pathname = "disasm";
+	int opt;
+	while ((opt = getopt(argc, argv, "c:g:p:T:")) != -1) {
+		switch(opt) {
+		case 'c': cmpname = optarg; break;
+		case 'g': goldname = optarg; break;
+		case 'p': pathname = optarg; break;
+		case 'T': timesname = optarg; break;
+		default:
+			fprintf(stderr, "usage: dis-opcheck [-p disasm|scan|flow] [-g golden] [-c golden] [-T times]\n");
+			exit(2);
+		}
+	}
+	Path *path = NULL;
+	for(int i = 0; i < (int)(sizeof(paths) / sizeof(paths[0])); i++) {
+		if (strcmp(paths[i].name, pathname) == 0)
+			path = &paths[i];
+	}
+	if (path == NULL) panic("No decoder path %s\n", pathname);
+
+	Buffer *buf = newBuffer();
+	bufferAddSection(buf, BASE, 2 + 2*NEXT, "scratch");
+	bytes = sectionReserve(&buf->sections[0], 2 + 2*NEXT)->_bytes;
+	Decoder *d = newDecoder(buf);
+	Labels *labels = newLabels(1);
+	FILE *gold = NULL, *cmp = NULL;
+	if (goldname != NULL && (gold = fopen(goldname, "w")) == NULL)
+		panic("Could not write %s\n", goldname);
+	if (cmpname != NULL && (cmp = fopen(cmpname, "r")) == NULL)
+		panic("Could not read %s\n", cmpname);
+
+	Group groups[NOPNUMS];
+	for(int i = 0; i < NOPNUMS; i++)
+		groups[i] = (Group){.opnum = i};
+	double *times = malloc(sizeof(double) * 65536);
+	long ndiffs = 0, nvalid = 0;
+	for(unsigned word = 0; word < 65536; word++) {
+		Record r;
+		for(int p = 0; p < NPATTERNS; p++) {
+			place(word, p);
+			nvalid += decode(path, d, labels, &r);
+			if (gold != NULL)
+				writerecord(gold, word, p, &r);
+			if (cmp != NULL) {
+				Record want;
+				unsigned gw;
+				int gp;
+				if (readrecord(cmp, &gw, &gp, &want) != 1 || gw != word || gp != p)
+					panic("%s: no record for %04x pattern %d\n", cmpname, word, p);
+				if (!same(&r, &want, path->fields) && ndiffs++ < MAXDIFFS) {
+					printf("%04x/%d %s:\t", word, p, cmpname);
+					writerecord(stdout, word, p, &want);
+					printf("%04x/%d %s:\t", word, p, path->name);
+					writerecord(stdout, word, p, &r);
+				}
+			}
+		}
+
+		// Decode time, per instruction, over all the patterns
+		double best = 1e30;
+		for(int k = 0; k < REPS; k++) {
+			double t = 0;
+			for(int p = 0; p < NPATTERNS; p++) {
+				place(word, p);
+				double t0 = now();
+				decode(path, d, labels, &r);
+				t += now() - t0;
+			}
+			if (t < best) best = t;
+		}
+		times[word] = best * 1e9 / NPATTERNS;
+
+		// Grouped by the optab entry the listing's decoder takes
+		Instruction in;
+		place(word, 0);
+		int opnum = disasmone(d, BASE, &in, labels) ? in.opnum : 0;
+		Group *g = &groups[opnum];
+		g->nwords++;
+		g->total += times[word];
+		if (times[word] > g->max) g->max = times[word];
+		if (opnum != 0) {
+			addname(g, &in);
+			free(in.asm);
+			free(in.instr);
+		} else if (g->names[0] == 0)
+			strcpy(g->names, "(invalid)");
+	}
+	if (gold != NULL) fclose(gold);
+
+	if (timesname != NULL) {
+		FILE *fp = fopen(timesname, "w");
+		if (fp == NULL) panic("Could not write %s\n", timesname);
+		for(int word = 0; word < 65536; word++)
+			fprintf(fp, "%04x %.1f\n", word, times[word]);
+		fclose(fp);
+	}
+	qsort(groups, NOPNUMS, sizeof(Group), slowest);
+	printf("%-6s %6s %9s %9s  %s\n", "opnum", "words", "mean ns", "max ns", "mnemonics");
+	for(int i = 0; i < NOPNUMS; i++) {
+		Group *g = &groups[i];
+		if (g->nwords == 0) continue;
+		printf("%-6d %6d %9.1f %9.1f  %s\n", g->opnum, g->nwords, g->total / g->nwords, g->max, g->names);
+	}
+	printf("%s: %ld of %d decoded\n", path->name, nvalid, 65536 * NPATTERNS);
+
+	if (cmp == NULL) return 0;
+	fclose(cmp);
+	printf("%s against %s: %ld differences\n", path->name, cmpname, ndiffs);
+	return ndiffs > 0;
+}
@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "dat.h"
+
+// The figures behind dis --stats: wall and CPU time for each phase of a
+// run, and counts of the calls that matter.  Counting is per thread, so the
+// decoder threads of the listing and the analysis never share a counter;
+// each thread's counts go on a list the first time it counts anything, and
+// the report adds them up.  None of this but the clock is built without
+// PRINT_STATS.
+
+static double seconds(clockid_t clock) {
+	struct timespec t;
+	clock_gettime(clock, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+double now(void) {
+	return seconds(CLOCK_MONOTONIC);
+}
+
+#ifdef PRINT_STATS
+
+#define MAXPHASES 16
+
+__thread Stats *statlocal;
+static Stats *all;
+static pthread_mutex_t alllock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	char *name;
+	double wall, cpu;
+} phases[MAXPHASES];
+static int nphases;
+static int current = -1; // Index in phases of the phase under way
+static double wall0, cpu0;
+
+Stats *statRegister(void) {
+	statlocal = calloc(1, sizeof(Stats));
+	pthread_mutex_lock(&alllock);
+	statlocal->next = all;
+	all = statlocal;
+	pthread_mutex_unlock(&alllock);
+	return statlocal;
+}
+
+// CPU time is the whole process's, so a phase that runs threads shows them all.
+void statPhase(char *name) {
+	double wall = now(), cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	if (current >= 0) {
+		phases[current].wall += wall - wall0;
+		phases[current].cpu += cpu - cpu0;
+	}
+	current = -1;
+	if (name == NULL) return;
+	for(current = 0; current < nphases; current++) {
+		if (strcmp(phases[current].name, name) == 0) break;
+	}
+	if (current == nphases) {
+		if (nphases == MAXPHASES) {
+			current = -1;
+			return;
+		}
+		phases[nphases++].name = name;
+	}
+	wall0 = wall;
+	cpu0 = cpu;
+}
+
+void statReport(FILE *fp) {
+	Stats sum = {0};
+	pthread_mutex_lock(&alllock);
+	for(Stats *s = all; s != NULL; s = s->next) {
+		sum.disasmone += s->disasmone;
+		sum.decodeone += s->decodeone;
+		sum.fetches += s->fetches;
+		sum.bufferreads += s->bufferreads;
+		sum.findlabel += s->findlabel;
+		sum.ilistgrows += s->ilistgrows;
+		sum.labelgrows += s->labelgrows;
+	}
+	pthread_mutex_unlock(&alllock);
+
+	double wall = 0, cpu = 0;
+	fprintf(fp, "%-16s %10s %10s\n", "phase", "wall ms", "cpu ms");
+	for(int i = 0; i < nphases; i++) {
+		fprintf(fp, "%-16s %10.2f %10.2f\n", phases[i].name, phases[i].wall * 1e3, phases[i].cpu * 1e3);
+		wall += phases[i].wall;
+		cpu += phases[i].cpu;
+	}
+	fprintf(fp, "%-16s %10.2f %10.2f\n", "total", wall * 1e3, cpu * 1e3);
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	long peak = ru.ru_maxrss / 1024; // bytes
+#else
+	long peak = ru.ru_maxrss; // kilobytes
+#endif
+	fprintf(fp, "disasmone        %10ld\n", sum.disasmone);
+	fprintf(fp, "decodeone        %10ld\n", sum.decodeone);
+	fprintf(fp, "decoder fetches  %10ld\n", sum.fetches);
+	fprintf(fp, "buffer reads     %10ld\n", sum.bufferreads);
+	fprintf(fp, "findLabelByAddr  %10ld\n", sum.findlabel);
+	fprintf(fp, "IList reallocs   %10ld\n", sum.ilistgrows);
+	fprintf(fp, "Labels reallocs  %10ld\n", sum.labelgrows);
+	fprintf(fp, "peak RSS KB      %10ld\n", peak);
+}
+
+#endif
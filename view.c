@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dat.h"
+
+// Formatted listing lines for the display, kept so that scrolling and
+// redrawing format each line once.  Slots are direct mapped by line number,
+// so the cache holds a window of lines around wherever the screen has been
+// and slides with it: a line that falls outside is simply overwritten.
+//
+// A line's text depends on the analysis, which replaces the cache when it
+// changes, and on the labels its operands name.  Each slot keeps those
+// addresses, so a renamed label drops just the lines that show it.  The
+// label in front of a line is looked up when it is drawn, not cached.
+
+#define WINDOWS 4 // Screens of lines the cache holds.
+
+struct View {
+	Decoder *dec;
+	LineIndex *lines;
+	Labels *labels;
+	ViewLine *slots;
+	int mask; // slots - 1; a power of two minus one
+};
+
+View *newView(Decoder *dec, LineIndex *lines, Labels *labels, int rows) {
+	View *v = malloc(sizeof(View));
+	v->dec = dec;
+	v->lines = lines;
+	v->labels = labels;
+	int n = 1;
+	while (n < WINDOWS * rows)
+		n *= 2;
+	v->slots = malloc(sizeof(ViewLine) * n);
+	v->mask = n - 1;
+	viewSetLines(v, lines);
+	return v;
+}
+
+void freeView(View *v) {
+	free(v->slots);
+	free(v);
+}
+
+// After an edit to the analysis every line may have moved.
+void viewSetLines(View *v, LineIndex *lines) {
+	v->lines = lines;
+	for(int i = 0; i <= v->mask; i++)
+		v->slots[i].line = -1;
+}
+
+void viewLabelChanged(View *v, int addr) {
+	for(int i = 0; i <= v->mask; i++) {
+		ViewLine *vl = &v->slots[i];
+		if (vl->line >= 0 && (vl->refs[0] == addr || vl->refs[1] == addr))
+			vl->line = -1;
+	}
+}
+
+static void keepdata(char *s, int addr, void *d) {
+	ViewLine *vl = d;
+	vl->addr = addr;
+	snprintf(vl->text, sizeof(vl->text), "%s", s);
+}
+
+static void render(View *v, ViewLine *vl, int line) {
+	LineIndex *li = v->lines;
+	int bb = findBlockByLine(li, line);
+	BasicBlock *b = &li->blocks[bb];
+	vl->line = line;
+	vl->isdata = b->isdata;
+	vl->refs[0] = vl->refs[1] = -1;
+	vl->text[0] = 0;
+	vl->addr = linetoaddr(li, line);
+	if (b->isdata) {
+		// Just this row: datadump() would otherwise walk the block up to it.
+		int k = line - b->lineno;
+		int rowend = (b->begin & ~0xf) + 16 * (k + 1);
+		datadump(v->dec, vl->addr, rowend < b->end ? rowend : b->end, keepdata, vl, 0);
+		return;
+	}
+	Instruction in;
+	if (!decodeone(v->dec, vl->addr, &in))
+		return;
+	sprintinstr(v->dec, vl->text, &in, v->labels);
+	for(int i = 0; i < in.nops && i < 2; i++)
+		vl->refs[i] = in.op[i].absaddr;
+}
+
+// The formatted line, or NULL outside the listing.  The slot is reused once
+// the view moves a few screens on.
+ViewLine *viewLine(View *v, int line) {
+	if (line < 0 || line >= v->lines->nlines)
+		return NULL;
+	ViewLine *vl = &v->slots[line & v->mask];
+	if (vl->line != line)
+		render(v, vl, line);
+	return vl;
+}
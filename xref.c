@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dat.h"
+
+// Cross references: every address an instruction names, found in one pass
+// over the code blocks and kept sorted by source and by target, so that
+// both "who references X" and "what does Y reference" are binary searches.
+
+char *xrefkinds[] = {
+	[XCALL] = "call", [XBRANCH] = "branch", [XJUMP] = "jump",
+	[XREAD] = "read", [XWRITE] = "write", [XADDR] = "addr",
+};
+
+// Whether an instruction leaves its destination operand as it was.
+static int readsdst(int mnemonic) {
+	switch(mnemonic) {
+	case M_CMP: case M_CMPA: case M_CMPI: case M_CMPM:
+	case M_TST: case M_BTST: case M_CHK:
+		return 1;
+	}
+	return 0;
+}
+
+// Whether the only operand of an instruction is written.
+static int writesonly(int mnemonic) {
+	switch(mnemonic) {
+	case M_CLR: case M_NEG: case M_NEGX: case M_NOT: case M_NBCD:
+	case M_SCC: case M_TAS:
+	case M_ASL: case M_ASR: case M_LSL: case M_LSR:
+	case M_ROL: case M_ROR: case M_ROXL: case M_ROXR:
+		return 1;
+	}
+	return 0;
+}
+
+static int kindof(Instruction *in, int i) {
+	Operand *op = &in->op[i];
+	if (op->kind == OPK_BRANCH)
+		return in->mnemonic == M_BCC && in->cc == 1 ? XCALL : XBRANCH; // BSR
+	switch(in->mnemonic) {
+	case M_JSR: return XCALL;
+	case M_JMP: return XJUMP;
+	case M_LEA: case M_PEA: return XADDR;
+	}
+	if (op->kind == OPK_EA && op->mode == 11)
+		return XADDR; // A long immediate
+	if (readsdst(in->mnemonic))
+		return XREAD;
+	if (i == 1 || (in->nops == 1 && writesonly(in->mnemonic)))
+		return XWRITE;
+	return XREAD;
+}
+
+static int byfrom(const void *a, const void *b) {
+	const Xref *x = a, *y = b;
+	if (x->from != y->from) return x->from < y->from ? -1 : 1;
+	if (x->to != y->to) return x->to < y->to ? -1 : 1;
+	return x->kind - y->kind;
+}
+
+static int byto(const void *a, const void *b) {
+	const Xref *x = a, *y = b;
+	if (x->to != y->to) return x->to < y->to ? -1 : 1;
+	if (x->from != y->from) return x->from < y->from ? -1 : 1;
+	return x->kind - y->kind;
+}
+
+Xrefs *newXrefs(Buffer *bin, BasicBlock *blocks, int nblocks) {
+	Xrefs *x = malloc(sizeof(Xrefs));
+	int cap = 1024, n = 0;
+	Xref *refs = malloc(sizeof(Xref) * cap);
+	Decoder *d = newDecoder(bin);
+	for(int i = 0; i < nblocks; i++) {
+		if (blocks[i].isdata) continue;
+		int addr = blocks[i].begin;
+		for(int k = 0; k < blocks[i].ninstr; k++) {
+			Instruction in;
+			if (!decodeone(d, addr, &in))
+				break;
+			for(int j = 0; j < in.nops && j < 2; j++) {
+				if (!in.op[j].hasabs) continue;
+				if (n == cap) {
+					cap *= 2;
+					refs = realloc(refs, sizeof(Xref) * cap);
+				}
+				refs[n++] = (Xref){.from = addr, .to = in.op[j].absaddr, .kind = kindof(&in, j)};
+			}
+			addr += in.nbytes;
+		}
+	}
+	freeDecoder(d);
+
+	// Overlapping blocks decode some instructions twice.
+	qsort(refs, n, sizeof(Xref), byfrom);
+	int len = 0;
+	for(int i = 0; i < n; i++) {
+		if (len > 0 && byfrom(&refs[len-1], &refs[i]) == 0) continue;
+		refs[len++] = refs[i];
+	}
+	x->byfrom = realloc(refs, sizeof(Xref) * (len + 1));
+	x->byto = malloc(sizeof(Xref) * (len + 1));
+	memcpy(x->byto, x->byfrom, sizeof(Xref) * len);
+	qsort(x->byto, len, sizeof(Xref), byto);
+	x->len = len;
+	x->shared = 0;
+	return x;
+}
+
+void freeXrefs(Xrefs *x) {
+	if (x->shared) return;
+	free(x->byfrom);
+	free(x->byto);
+	free(x);
+}
+
+// The first of refs whose from (or to) is at least addr.
+static int lowerbound(Xref *refs, int len, int addr, int to) {
+	int l = 0, r = len;
+	while (l < r) {
+		int m = l + (r - l) / 2;
+		if ((to ? refs[m].to : refs[m].from) < addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l;
+}
+
+int xrefsTo(Xrefs *x, int begin, int end, Xref **out) {
+	int l = lowerbound(x->byto, x->len, begin, 1);
+	*out = x->byto + l;
+	return lowerbound(x->byto, x->len, end, 1) - l;
+}
+
+int xrefsFrom(Xrefs *x, int begin, int end, Xref **out) {
+	int l = lowerbound(x->byfrom, x->len, begin, 0);
+	*out = x->byfrom + l;
+	return lowerbound(x->byfrom, x->len, end, 0) - l;
+}